@@ -114,8 +114,7 @@ def make_table(experiments):
 									test_set, 
 									similarity_measure, 
 									zone_map,
-									show_cmd_outputs=False,
-									crop_border=2)
+									show_cmd_outputs=False)
 		results_table.add_row([name, err[0], err[1]])
 
 	return results_table
@@ -147,8 +146,7 @@ def goal_fn(X):
 								ref_set, 
 								test_set, 
 								similarity_measure, 
-								zone_map,
-								crop_border=kernel_size//2+1)
+								zone_map)
 		err0 += err[0]
 		err1 += err[1]
 
@@ -47,7 +47,8 @@ test_input_path = "../Sprites/Input/Armor/"
 test_output_path = "../Sprites/Output/Armor/"
 
 def makeReferenceAnis():
-	# create maps
+	# create all maps in one process that shares the reference inputs
+	jobs = []
 	for part in parts:
 		out_name = "{}_Walk.map".format(part)
 		if os.path.isfile(out_name):
@@ -55,17 +56,21 @@ def makeReferenceAnis():
 		zone_map_name = makeZoneMapName(part, 3, "Walk")
 		if not os.path.isfile(zone_map_name[0]) or not os.path.isfile(zone_map_name[1]):
 			continue
-		zone_map_cmd = "-i {} -t {} -z".format(zone_map_name[0], zone_map_name[1])
-		inputs_args = scan.make_arg_list(generation_input)
-		command = "AniGen create {} {} -n {} -m {} -r {} -s \"{}\" -o \"{}\" --crop {} -j 4".format(
-			zone_map_cmd,
+		targets = " ".join(target for _, target in generation_input)
+		jobs.append("{} | {} | {} {}".format(out_name, targets, zone_map_name[0], zone_map_name[1]))
+
+	if jobs:
+		job_file = "Walk_jobs.txt"
+		with open(job_file, "w") as f:
+			f.write("\n".join(jobs) + "\n")
+		inputs_args = " ".join("-i \"{}\"".format(inp) for inp, _ in generation_input)
+		command = "AniGen create {} -n {} -m {} -r {} -s \"{}\" --jobs \"{}\" -j 4".format(
 			inputs_args,
 			1,
 			8,
 			0,
 			similarity_measures[1],
-			out_name,
-			2
+			job_file
 		)
 		subprocess.run(command, check=True, capture_output=False)
 
@@ -2,26 +2,41 @@
 #include "../utils/utils.hpp"
 #include "../utils/spritesheet.hpp"
 #include "../utils/colors.hpp"
+#include "pixelsimilarity.hpp"
 
 #include <assert.h>
+#include <array>
 #include <iostream>
 
 using namespace math;
 
 
-ZoneMap::ZoneMap(const sf::Image& _src, const sf::Image& _dst, bool _withAlphaMarks)
-	: m_dst(_dst),
+ZoneIndex::ZoneIndex(const ImageView& _image, bool _withAlphaMarks)
+	: m_size(_image.getSize()),
 	m_ignoreMask(_withAlphaMarks ? 0xffffff00 : 0xffffffff)
 {
-	const sf::Vector2u size = _src.getSize();
-	for (unsigned y = 0; y < size.y; ++y)
+	m_zoneIds.resize(static_cast<size_t>(m_size.x) * m_size.y);
+	// neighbouring pixels mostly share the zone, which saves the palette lookup
+	sf::Uint32 lastCol = 0;
+	ZoneId lastId = NO_ZONE;
+	for (unsigned y = 0; y < m_size.y; ++y)
 	{
-		for (unsigned x = 0; x < size.x; ++x)
+		for (unsigned x = 0; x < m_size.x; ++x)
 		{
-			const sf::Color col = _src.getPixel(x, y);
-			const sf::Uint32 colMasked = maskColor(_src.getPixel(x, y).toInteger());
-			PixelList& pixelList = m_srcZones[colMasked];
-			m_srcZones[colMasked].push_back(x + y * size.x);
+			const sf::Color col = _image.getPixel(x, y);
+			const sf::Uint32 colMasked = maskColor(col.toInteger());
+			if (lastId == NO_ZONE || colMasked != lastCol)
+			{
+				auto [it, isNew] = m_palette.try_emplace(colMasked, static_cast<ZoneId>(m_zones.size()));
+				if (isNew)
+					m_zones.emplace_back(colMasked, PixelList());
+				lastCol = colMasked;
+				lastId = it->second;
+			}
+			const size_t ind = x + y * m_size.x;
+			m_zoneIds[ind] = lastId;
+			PixelList& pixelList = m_zones[lastId].second;
+			pixelList.push_back(ind);
 			if (_withAlphaMarks && col.a != 255)
 			{
 				pixelList.marks.push_back({pixelList.size()-1, col.a});
@@ -30,25 +45,77 @@ ZoneMap::ZoneMap(const sf::Image& _src, const sf::Image& _dst, bool _withAlphaMa
 	}
 }
 
-const PixelList& ZoneMap::operator()(unsigned x, unsigned y) const
+ZoneIndex::ZoneId ZoneIndex::findZone(sf::Uint32 _col) const
 {
-	return (*this)(m_dst.getPixel(x, y));
+	auto it = m_palette.find(maskColor(_col));
+	return it != m_palette.end() ? it->second : NO_ZONE;
 }
 
-const PixelList& ZoneMap::operator()(sf::Color _color) const
+// ************************************************************* //
+ZoneMap::ZoneMap(const ImageView& _src, const ImageView& _dst, bool _withAlphaMarks)
+	: ZoneMap(std::make_shared<const ZoneIndex>(_src, _withAlphaMarks), _dst)
 {
-	return (*this)(_color.toInteger());
 }
 
-const PixelList& ZoneMap::operator()(sf::Uint32 _color) const
+ZoneMap::ZoneMap(std::shared_ptr<const ZoneIndex> _src, const ImageView& _dst)
+	: m_src(std::move(_src)),
+	m_dst(_dst)
 {
-	auto it = m_srcZones.find(maskColor(_color));
-	return it != m_srcZones.end() ? it->second : m_defaultZone;
+	const sf::Vector2u dstSize = _dst.getSize();
+	m_dstZoneIds.resize(static_cast<size_t>(dstSize.x) * dstSize.y);
+	sf::Uint32 lastCol = 0;
+	ZoneId lastId = NO_ZONE;
+	bool isFirst = true;
+	for (unsigned y = 0; y < dstSize.y; ++y)
+		for (unsigned x = 0; x < dstSize.x; ++x)
+		{
+			// the index applies its own color mask
+			const sf::Uint32 col = _dst.getPixel(x, y).toInteger();
+			if (isFirst || col != lastCol)
+			{
+				isFirst = false;
+				lastCol = col;
+				lastId = m_src->findZone(col);
+			}
+			m_dstZoneIds[x + y * dstSize.x] = lastId;
+		}
 }
 
-sf::Uint32 ZoneMap::maskColor(sf::Uint32 _col) const
-{
-	return _col & m_ignoreMask;
+namespace details {
+	std::vector<ZoneTargets> groupTargetsByZone(const ZoneMap& _zoneMap, size_t _maxTargets)
+	{
+		const sf::Vector2u size = _zoneMap.getDst().getSize();
+		// the last group collects the targets without a zone
+		std::vector<ZoneTargets> groups(_zoneMap.numZones() + 1);
+		for (ZoneMap::ZoneId id = 0; id < _zoneMap.numZones(); ++id)
+			groups[id].zone = &_zoneMap.zone(id);
+		groups.back().zone = &_zoneMap.zone(ZoneMap::NO_ZONE);
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+			{
+				const ZoneMap::ZoneId id = _zoneMap.zoneId(x, y);
+				groups[id == ZoneMap::NO_ZONE ? _zoneMap.numZones() : id].targets.push_back(x + y * size.x);
+			}
+
+		std::vector<ZoneTargets> units;
+		for (ZoneTargets& group : groups)
+		{
+			for (size_t begin = 0; begin < group.targets.size(); begin += _maxTargets)
+			{
+				const size_t end = std::min(begin + _maxTargets, group.targets.size());
+				units.push_back(ZoneTargets{ group.zone, 
+					std::vector<size_t>(group.targets.begin() + begin, group.targets.begin() + end) });
+			}
+		}
+
+		auto cost = [](const ZoneTargets& _unit) { return _unit.targets.size() * _unit.zone->size(); };
+		std::stable_sort(units.begin(), units.end(), [&](const ZoneTargets& a, const ZoneTargets& b)
+			{
+				return cost(a) > cost(b);
+			});
+
+		return units;
+	}
 }
 
 // ************************************************************* //
@@ -80,21 +147,47 @@ void ErrorImageWrapper::draw(const PixelList& _pixels, sf::Color _color, bool _d
 	}
 }
 
+void ErrorImageWrapper::draw(sf::Vector2u _pos, sf::Color _color)
+{
+	if (_color != sf::Color::Black)
+		m_isEmpty = false;
+	_color.a = 255;
+	m_image.setPixel(_pos.x, _pos.y, _color);
+}
+
+void ErrorImageWrapper::draw(const utils::Diagnostics& _diagnostics, utils::Diagnostics::Input _input)
+{
+	for (const utils::Diagnostics::Issue& issue : _diagnostics.issues())
+	{
+		if (issue.input != _input)
+			continue;
+		for (const sf::Vector2u& pos : issue.positions)
+			draw(pos, issue.color);
+	}
+}
+
+void DeferredErrorImage::apply(ErrorImageWrapper& _image) const
+{
+	for (const Draw& draw : m_draws)
+		_image.draw(*draw.pixels, draw.color, draw.drawMarks);
+}
+
 // ************************************************************* //
-sf::Image applyMap(const TransferMap& _map, const sf::Image& _src)
+sf::Image applyMap(const TransferMap& _map, const ImageView& _src)
 {
-	sf::Image image;
-	image.create(_src.getSize().x, _src.getSize().y, sf::Color::Black);
-	for (unsigned y = 0; y < image.getSize().y; ++y)
+	const sf::Vector2u size = _src.getSize();
+	ImageBuffer buffer(size);
+	const MutableImageView image = buffer.view();
+	for (unsigned y = 0; y < size.y; ++y)
 	{
-		const unsigned idy = y * image.getSize().x;
-		for (unsigned x = 0; x < image.getSize().x; ++x)
+		const unsigned idy = y * size.x;
+		for (unsigned x = 0; x < size.x; ++x)
 		{
 			const sf::Vector2u& srcPos = _map[x + idy];
-			image.setPixel(x, y, _src.getPixel(srcPos.x, srcPos.y));
+			image.setPixel(x, y, _src(srcPos.x, srcPos.y));
 		}
 	}
-	return image;
+	return buffer.toImage();
 }
 
 // ************************************************************* //
@@ -135,7 +228,357 @@ TransferMap extendMap(const TransferMap& _map,
 	return result;
 }
 
-std::pair<sf::Uint8, sf::Uint8> minMaxBrightness(const sf::Image& _reference)
+TransferMap cropMap(const TransferMap& _map, const sf::IntRect& _rect)
+{
+	const sf::Vector2u size(_rect.width, _rect.height);
+	const sf::Vector2u position(_rect.left, _rect.top);
+	TransferMap result(size);
+	for (unsigned y = 0; y < size.y; ++y)
+		for (unsigned x = 0; x < size.x; ++x)
+		{
+			const sf::Vector2u src = _map(x + position.x, y + position.y);
+			const bool isInside = src.x >= position.x && src.y >= position.y
+				&& src.x < position.x + size.x && src.y < position.y + size.y;
+			result(x, y) = isInside ? src - position : sf::Vector2u(x, y);
+		}
+
+	return result;
+}
+
+TransferMap mirrorMap(const TransferMap& _map, bool _mirrorSources)
+{
+	const unsigned maxX = _map.size.x - 1;
+	TransferMap result(_map.size);
+	for (unsigned y = 0; y < _map.size.y; ++y)
+		for (unsigned x = 0; x < _map.size.x; ++x)
+		{
+			sf::Vector2u src = _map(maxX - x, y);
+			if (_mirrorSources)
+				src.x = maxX - src.x;
+			result(x, y) = src;
+		}
+
+	return result;
+}
+
+std::vector<TransferMap> mergeShards(const std::vector<ShardHeader>& _headers,
+	const std::vector<std::vector<TransferMap>>& _shardMaps)
+{
+	assert(_headers.size() == _shardMaps.size());
+	if (_headers.empty())
+		return {};
+
+	const ShardHeader& first = _headers.front();
+	const unsigned count = first.shard.count;
+	if (_headers.size() != count)
+	{
+		std::cerr << "[Error] Expected " << count << " shards but got " << _headers.size() << ".\n";
+		return {};
+	}
+
+	// each shard exactly once and all created with the same inputs
+	std::vector<int> shardInds(count, -1);
+	for (size_t i = 0; i < _headers.size(); ++i)
+	{
+		const ShardHeader& header = _headers[i];
+		const bool isConsistent = header.shard.count == count
+			&& header.cropRect == first.cropRect
+			&& header.reusedFrames.size() == first.reusedFrames.size()
+			&& std::equal(header.reusedFrames.begin(), header.reusedFrames.end(), first.reusedFrames.begin(),
+				[](const ShardHeader::ReusedFrame& a, const ShardHeader::ReusedFrame& b)
+				{
+					return a.frame == b.frame && a.source == b.source;
+				});
+		if (!isConsistent || header.shard.index >= count)
+		{
+			std::cerr << "[Error] Shard " << header.shard.index << "/" << header.shard.count
+				<< " does not belong to the same run as shard " << first.shard.index << "/" << count << ".\n";
+			return {};
+		}
+		if (shardInds[header.shard.index] != -1)
+		{
+			std::cerr << "[Error] Shard " << header.shard.index << " is given multiple times.\n";
+			return {};
+		}
+		shardInds[header.shard.index] = static_cast<int>(i);
+
+		if (_shardMaps[i].size() != _shardMaps.front().size())
+		{
+			std::cerr << "[Error] Shard " << header.shard.index << " has " << _shardMaps[i].size()
+				<< " frames instead of " << _shardMaps.front().size() << ".\n";
+			return {};
+		}
+		for (size_t k = 0; k < _shardMaps[i].size(); ++k)
+			if (_shardMaps[i][k].size != _shardMaps.front()[k].size)
+			{
+				std::cerr << "[Error] Frame " << k << " of shard " << header.shard.index << " has a different size.\n";
+				return {};
+			}
+	}
+
+	std::vector<TransferMap> merged = _shardMaps.front();
+	for (size_t k = 0; k < merged.size(); ++k)
+	{
+		TransferMap& map = merged[k];
+		for (unsigned y = 0; y < map.size.y; ++y)
+			for (unsigned shardInd = 0; shardInd < count; ++shardInd)
+				if (Shard{ shardInd, count }.ownsRow(static_cast<int>(k), y, map.size.y))
+				{
+					const TransferMap& shardMap = _shardMaps[shardInds[shardInd]][k];
+					for (unsigned x = 0; x < map.size.x; ++x)
+						map(x, y) = shardMap(x, y);
+				}
+	}
+
+	for (const ShardHeader::ReusedFrame& reused : first.reusedFrames)
+	{
+		if (reused.frame < 0 || reused.source < 0 
+			|| static_cast<size_t>(std::max(reused.frame, reused.source)) >= merged.size())
+		{
+			std::cerr << "[Error] The reused frame " << reused.frame << " does not exist.\n";
+			return {};
+		}
+		merged[reused.frame] = merged[reused.source];
+	}
+
+	return merged;
+}
+
+void writeCheckpoint(std::ostream& _out, std::uint64_t _hash, const std::vector<TransferMap>& _maps)
+{
+	_out << "checkpoint " << std::hex << _hash << std::dec << " " << _maps.size() << "\n";
+	for (const TransferMap& map : _maps)
+		_out << map;
+}
+
+bool readCheckpoint(std::istream& _in, std::uint64_t _hash, sf::Vector2u _size, std::vector<TransferMap>& _maps)
+{
+	std::string tag;
+	std::uint64_t hash = 0;
+	size_t numMaps = 0;
+	if (!(_in >> tag >> std::hex >> hash >> std::dec >> numMaps) || tag != "checkpoint" || hash != _hash)
+		return false;
+
+	_maps.resize(numMaps);
+	for (TransferMap& map : _maps)
+		if (!(_in >> map) || map.size != _size)
+			return false;
+
+	return true;
+}
+
+std::vector<std::pair<TransferMap, math::Matrix<float>>> constructMaps(
+	const std::vector<AnyDistance>& _distanceMeasures,
+	const ZoneMap* _zoneMap,
+	unsigned _numThreads,
+	sf::Vector2u _originOffset,
+	const MapSearchOptions& _options)
+{
+	// not supported, see constructMaps
+	assert(!_options.margin && !_options.seedMap);
+	std::vector<std::pair<TransferMap, math::Matrix<float>>> results;
+	if (_distanceMeasures.empty())
+		return results;
+
+	const sf::Vector2u size = _distanceMeasures.front().getSize();
+	for (const AnyDistance& distanceMeasure : _distanceMeasures)
+	{
+		assert(distanceMeasure.getSize() == size);
+		results.emplace_back(TransferMap(size), math::Matrix<float>(size));
+	}
+	const math::ArrayShape2D& shape = results.front().first;
+	assert(!_options.targetMask || _options.targetMask->size == size);
+	assert(!_options.initialMap || _options.initialMap->size == size);
+
+	// zones are sorted, but a zone map can decide the membership directly
+	auto isInZone = [_zoneMap](const PixelList& _zone, size_t _ind, unsigned x, unsigned y)
+	{
+		return _zoneMap ? _zoneMap->sharesZone(_ind, x, y) : std::binary_search(_zone.begin(), _zone.end(), _ind);
+	};
+
+	using TargetDistances = std::vector<std::unique_ptr<AnyDistance::TargetDistance>>;
+	using Searches = std::vector<::details::SearchResult>;
+	// candidates are evaluated in blocks to call each measure once per block
+	constexpr size_t BLOCK_SIZE = 64;
+	struct Block
+	{
+		std::array<size_t, BLOCK_SIZE> indices;
+		std::array<sf::Vector2u, BLOCK_SIZE> sources;
+		std::array<float, BLOCK_SIZE> distances;
+		size_t size = 0;
+	};
+	utils::Diagnostics ownDiagnostics;
+	utils::Diagnostics& diagnostics = _options.diagnostics ? *_options.diagnostics : ownDiagnostics;
+
+	// @param _zone The candidates if restricted, otherwise nullptr.
+	// @param _distances, _searches, _block, _issues Buffers of the current thread.
+	auto searchTarget = [&](unsigned x, unsigned y, const PixelList* _zone, 
+		TargetDistances& _distances, Searches& _searches, Block& _block, utils::Diagnostics::Local& _issues)
+	{
+		if (_options.targetMask && !(*_options.targetMask)(x, y))
+		{
+			for (auto& [map, confidence] : results)
+			{
+				map(x, y) = _options.initialMap ? (*_options.initialMap)(x, y) : sf::Vector2u(x, y);
+				confidence(x, y) = 0.f;
+			}
+			return;
+		}
+
+		_distances.resize(_distanceMeasures.size());
+		for (size_t k = 0; k < _distanceMeasures.size(); ++k)
+			_distances[k] = _distanceMeasures[k].forTarget(x, y);
+
+		// the start candidate and tie breaking are the same as in constructMap
+		::details::Candidate start{ shape.flatIndex(x, y), 0.f, true };
+		if (_zone)
+		{
+			if (_zone->empty() && _zoneMap)
+			{
+				_issues.add(utils::Diagnostics::Kind::MissingZone, utils::Diagnostics::Input::Target,
+					(*_zoneMap).getDst().getPixel(x, y), sf::Vector2u(x, y));
+			}
+			else if (!_zone->empty() && !isInZone(*_zone, start.index, x, y))
+				start = ::details::Candidate{ _zone->front(), 0.f, false };
+		}
+
+		_searches.clear();
+		const sf::Vector2u startSource = shape.index(start.index);
+		for (size_t k = 0; k < _distances.size(); ++k)
+		{
+			::details::Candidate best = start;
+			(*_distances[k])(&startSource, 1, NO_DISTANCE_BOUND, &best.distance);
+			_searches.push_back(::details::SearchResult{ best, false });
+		}
+
+		// The bound of a block is the one from its start. It is never smaller than the 
+		// bound of each candidate, so the results stay the same.
+		auto flush = [&]()
+		{
+			for (size_t k = 0; k < _distances.size(); ++k)
+			{
+				(*_distances[k])(_block.sources.data(), _block.size, _searches[k].bound(), _block.distances.data());
+				for (size_t i = 0; i < _block.size; ++i)
+					_searches[k].add(_block.indices[i], _block.distances[i]);
+			}
+			_block.size = 0;
+		};
+		auto addCandidate = [&](size_t _ind)
+		{
+			_block.indices[_block.size] = _ind;
+			_block.sources[_block.size] = shape.index(_ind);
+			if (++_block.size == BLOCK_SIZE)
+				flush();
+		};
+
+		if (_zone)
+		{
+			for (size_t ind : *_zone)
+				addCandidate(ind);
+		}
+		else
+		{
+			for (size_t ind = 0; ind < math::ArrayShape2D::numElements(size); ++ind)
+				addCandidate(ind);
+		}
+		flush();
+
+		for (size_t k = 0; k < _searches.size(); ++k)
+		{
+			results[k].first(x, y) = shape.index(_searches[k].best.index);
+			results[k].second(x, y) = _searches[k].best.distance;
+		}
+	};
+
+	if (_zoneMap)
+	{
+		const std::vector<::details::ZoneTargets> zones = ::details::groupTargetsByZone(*_zoneMap);
+		utils::runMultiThreaded(size_t(0), zones.size(), [&](size_t begin, size_t end)
+			{
+				TargetDistances distances;
+				Searches searches;
+				Block block;
+				utils::Diagnostics::Local issues(diagnostics);
+				for (size_t i = begin; i < end; ++i)
+					for (size_t target : zones[i].targets)
+					{
+						const sf::Vector2u pos = shape.index(target);
+						searchTarget(pos.x, pos.y, zones[i].zone, distances, searches, block, issues);
+					}
+			}, _numThreads);
+	}
+	else
+	{
+		utils::runMultiThreaded(0u, size.y, [&](unsigned begin, unsigned end)
+			{
+				TargetDistances distances;
+				Searches searches;
+				Block block;
+				utils::Diagnostics::Local issues(diagnostics);
+				for (unsigned y = begin; y < end; ++y)
+					for (unsigned x = 0; x < size.x; ++x)
+						searchTarget(x, y, _options.candidates, distances, searches, block, issues);
+			}, _numThreads);
+	}
+
+	if (!_options.diagnostics)
+		ownDiagnostics.print(std::cout, _originOffset);
+
+	return results;
+}
+
+PixelMask makeActiveMask(const std::vector<ImageView>& _images, unsigned _radius)
+{
+	assert(!_images.empty());
+	const sf::Vector2u size = _images.front().getSize();
+	PixelMask mask(size);
+	for (const ImageView& image : _images)
+	{
+		assert(image.getSize() == size);
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+				mask(x, y) |= image.getPixel(x, y).a != 0;
+	}
+
+	// separable dilation with a square of size 2 * _radius + 1
+	PixelMask rows(size);
+	for (unsigned y = 0; y < size.y; ++y)
+		for (unsigned x = 0; x < size.x; ++x)
+			if (mask(x, y))
+			{
+				const unsigned end = std::min(x + _radius + 1, size.x);
+				for (unsigned ix = x > _radius ? x - _radius : 0u; ix < end; ++ix)
+					rows(ix, y) = 1;
+			}
+	PixelMask dilated(size);
+	for (unsigned y = 0; y < size.y; ++y)
+		for (unsigned x = 0; x < size.x; ++x)
+			if (rows(x, y))
+			{
+				const unsigned end = std::min(y + _radius + 1, size.y);
+				for (unsigned iy = y > _radius ? y - _radius : 0u; iy < end; ++iy)
+					dilated(x, iy) = 1;
+			}
+
+	// kernels at the border reach the padding, which is not transparent
+	for (unsigned y = 0; y < size.y; ++y)
+		for (unsigned x = 0; x < size.x; ++x)
+			if (x < _radius || y < _radius || x + _radius >= size.x || y + _radius >= size.y)
+				dilated(x, y) = 1;
+
+	return dilated;
+}
+
+PixelList maskToPixelList(const PixelMask& _mask)
+{
+	PixelList pixels;
+	for (size_t i = 0; i < _mask.elements.size(); ++i)
+		if (_mask[i])
+			pixels.push_back(i);
+	return pixels;
+}
+
+std::pair<sf::Uint8, sf::Uint8> minMaxBrightness(const ImageView& _reference)
 {
 	const sf::Vector2u size = _reference.getSize();
 	sf::Uint8 min = 255;
@@ -155,11 +598,11 @@ std::pair<sf::Uint8, sf::Uint8> minMaxBrightness(const sf::Image& _reference)
 	return { min,max };
 }
 
-sf::Image makeColorGradientImage(const sf::Image& _reference, bool _rgb)
+sf::Image makeColorGradientImage(const ImageView& _reference, bool _rgb)
 {
-	sf::Image prototypeImg;
 	const sf::Vector2u size = _reference.getSize();
-	prototypeImg.create(size.x, size.y);
+	ImageBuffer buffer(size);
+	const MutableImageView prototypeImg = buffer.view();
 
 	auto [minCol, maxCol] = minMaxBrightness(_reference);
 	const float range = static_cast<float>(maxCol - minCol);
@@ -196,7 +639,7 @@ sf::Image makeColorGradientImage(const sf::Image& _reference, bool _rgb)
 		}
 	}
 
-	return prototypeImg;
+	return buffer.toImage();
 }
 
 sf::Image colorMap(const TransferMap& transferMap, const sf::Image& _reference, bool _rgb)
@@ -262,4 +705,36 @@ std::istream& operator>>(std::istream& _in, TransferMap& _transferMap)
 	}
 
 	return _in;
-}
\ No newline at end of file
+}
+
+std::ostream& operator<<(std::ostream& _out, const ShardHeader& _header)
+{
+	const sf::IntRect& rect = _header.cropRect;
+	_out << "shard " << _header.shard.index << " " << _header.shard.count << "\n"
+		<< rect.left << " " << rect.top << " " << rect.width << " " << rect.height << "\n"
+		<< _header.reusedFrames.size() << "\n";
+	for (const ShardHeader::ReusedFrame& reused : _header.reusedFrames)
+		_out << reused.frame << " " << reused.source << "\n";
+
+	return _out;
+}
+
+std::istream& operator>>(std::istream& _in, ShardHeader& _header)
+{
+	std::string tag;
+	if (!(_in >> tag) || tag != "shard")
+	{
+		_in.setstate(std::ios::failbit);
+		return _in;
+	}
+	sf::IntRect& rect = _header.cropRect;
+	size_t numReused = 0;
+	_in >> _header.shard.index >> _header.shard.count
+		>> rect.left >> rect.top >> rect.width >> rect.height
+		>> numReused;
+	_header.reusedFrames.resize(numReused);
+	for (ShardHeader::ReusedFrame& reused : _header.reusedFrames)
+		_in >> reused.frame >> reused.source;
+
+	return _in;
+}
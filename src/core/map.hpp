@@ -4,8 +4,13 @@
 #include "../math/matrix.hpp"
 #include "../utils/utils.hpp"
 #include "../utils/colors.hpp"
+#include "../utils/imageview.hpp"
+#include "../utils/diagnostics.hpp"
 
 #include <unordered_map>
+#include <memory>
+#include <limits>
+#include <cstdint>
 
 class PixelList : public std::vector<size_t>
 {
@@ -19,29 +24,84 @@ public:
 	std::vector<Mark> marks;
 };
 
-class ZoneMap
+// Partition of the pixels of one image by color.
+// The zones are indexed densely in the order in which their color first occurs.
+class ZoneIndex
 {
 public:
-	ZoneMap(const sf::Image& _src, const sf::Image& _dst, bool _withAlphaMarks = false);
+	using ZoneId = std::uint32_t;
+	// id of pixels whose color does not exist in the image
+	static constexpr ZoneId NO_ZONE = std::numeric_limits<ZoneId>::max();
+
+	// @param _withAlphaMarks Ignore the alpha channel for the color and store pixels
+	//		with alpha != 255 as marks of their zone.
+	explicit ZoneIndex(const ImageView& _image, bool _withAlphaMarks = false);
 
-	//using PixelList = std::vector<size_t>;
-	const PixelList& operator()(unsigned x, unsigned y) const;
-	const PixelList& operator()(sf::Color _col) const;
-	const PixelList& operator()(sf::Uint32 _col) const;
+	// Zone of the pixel with flat index _pixel.
+	ZoneId zoneId(size_t _pixel) const { return m_zoneIds[_pixel]; }
+	// Zone with color _col or NO_ZONE. The alpha channel is ignored if the index has marks.
+	ZoneId findZone(sf::Uint32 _col) const;
+	const PixelList& zone(ZoneId _id) const { return _id == NO_ZONE ? m_defaultZone : m_zones[_id].second; }
+	size_t numZones() const { return m_zones.size(); }
+	// The pixels of a color as sorted flat indices.
+	const PixelList& operator()(sf::Uint32 _col) const { return zone(findZone(_col)); }
 
-	auto begin() const { return m_srcZones.begin(); }
-	auto end() const { return m_srcZones.end(); }
+	// (color, pixels) for each zone
+	auto begin() const { return m_zones.begin(); }
+	auto end() const { return m_zones.end(); }
 
-	const sf::Image& getDst() const { return m_dst; };
+	const sf::Vector2u& getSize() const { return m_size; }
 private:
-	sf::Uint32 maskColor(sf::Uint32 _col) const;
+	sf::Uint32 maskColor(sf::Uint32 _col) const { return _col & m_ignoreMask; }
 
-	std::unordered_map<sf::Uint32, PixelList> m_srcZones;
-	const sf::Image& m_dst;
-	PixelList m_defaultZone; //< empty zone returned if a color does not exist in the reference
+	std::vector<std::pair<sf::Uint32, PixelList>> m_zones;
+	// only used to assign the ids
+	std::unordered_map<sf::Uint32, ZoneId> m_palette;
+	// zone of each pixel in row-major order
+	std::vector<ZoneId> m_zoneIds;
+	PixelList m_defaultZone; //< empty zone returned if a color does not exist
+	sf::Vector2u m_size;
 	sf::Uint32 m_ignoreMask;
 };
 
+// Partition of the source and target pixels by the zones of the source.
+// The source side does not depend on the target and can be shared by all frames.
+class ZoneMap
+{
+public:
+	using ZoneId = ZoneIndex::ZoneId;
+	// id of target pixels whose color does not exist in the source
+	static constexpr ZoneId NO_ZONE = ZoneIndex::NO_ZONE;
+
+	ZoneMap(const ImageView& _src, const ImageView& _dst, bool _withAlphaMarks = false);
+	// Only assigns the target pixels to the zones of an existing source index.
+	// The colors of the target are masked like those of _src.
+	ZoneMap(std::shared_ptr<const ZoneIndex> _src, const ImageView& _dst);
+
+	// The source pixels in the zone of target (x,y) as sorted flat indices.
+	const PixelList& operator()(unsigned x, unsigned y) const { return zone(zoneId(x, y)); }
+	const PixelList& operator()(sf::Color _col) const { return (*m_src)(_col.toInteger()); }
+	const PixelList& operator()(sf::Uint32 _col) const { return (*m_src)(_col); }
+
+	ZoneId zoneId(unsigned x, unsigned y) const { return m_dstZoneIds[x + y * m_dst.getSize().x]; }
+	const PixelList& zone(ZoneId _id) const { return m_src->zone(_id); }
+	size_t numZones() const { return m_src->numZones(); }
+	// Whether the source pixel with flat index _src is in the zone of target (x,y).
+	bool sharesZone(size_t _src, unsigned x, unsigned y) const { return m_src->zoneId(_src) == zoneId(x, y); }
+
+	// (color, source pixels) for each zone
+	auto begin() const { return m_src->begin(); }
+	auto end() const { return m_src->end(); }
+
+	const ZoneIndex& getSrc() const { return *m_src; }
+	const ImageView& getDst() const { return m_dst; };
+private:
+	std::shared_ptr<const ZoneIndex> m_src;
+	// zone of each target pixel in row-major order
+	std::vector<ZoneId> m_dstZoneIds;
+	ImageView m_dst;
+};
+
 class ErrorImageWrapper
 {
 	sf::Image& m_image;
@@ -51,96 +111,412 @@ public:
 
 	void draw(const PixelList& _pixels, sf::Color _color, bool _drawMarks = false);
 	void draw(sf::Vector2u _pos, sf::Color _color);
+	// Highlight the positions of all issues found in _input.
+	void draw(const utils::Diagnostics& _diagnostics, utils::Diagnostics::Input _input);
 	bool isEmpty() const { return m_isEmpty; }
 };
 
+// Draw calls of one task that are applied to an ErrorImageWrapper later, so that
+// parallel tasks do not write into the same image.
+class DeferredErrorImage
+{
+public:
+	// _pixels has to outlive the call to apply.
+	void draw(const PixelList& _pixels, sf::Color _color, bool _drawMarks = false)
+	{
+		m_draws.push_back(Draw{ &_pixels, _color, _drawMarks });
+	}
+	void apply(ErrorImageWrapper& _image) const;
+private:
+	struct Draw
+	{
+		const PixelList* pixels;
+		sf::Color color;
+		bool drawMarks;
+	};
+	std::vector<Draw> m_draws;
+};
+
 // each element contains the coordinates for the source
 using TransferMap = math::Matrix<sf::Vector2u>;
 
 // Apply the map to a single image.
-sf::Image applyMap(const TransferMap& _map, const sf::Image& _src);
+sf::Image applyMap(const TransferMap& _map, const ImageView& _src);
 
 // Extend a map with identity elements.
 TransferMap extendMap(const TransferMap& _map, 
 	const sf::Vector2u& _size, 
 	const sf::Vector2u& _position);
 
+// Restrict a map to the targets in _rect. Sources outside of _rect are replaced by the identity.
+TransferMap cropMap(const TransferMap& _map, const sf::IntRect& _rect);
+
+// Map for the horizontally mirrored targets. With _mirrorSources the mapped
+// sources are mirrored as well, i.e. the map is applied to a mirrored reference.
+TransferMap mirrorMap(const TransferMap& _map, bool _mirrorSources);
+
+// Part of the map creation that is done by one of several processes. 
+// Row y of frame k belongs to shard (k * height + y) % count, with the height of the full map.
+struct Shard
+{
+	unsigned index = 0;
+	unsigned count = 1;
+
+	bool ownsRow(int _frame, unsigned _y, unsigned _height) const
+	{
+		return (static_cast<size_t>(_frame) * _height + _y) % count == index;
+	}
+};
+
+// Preamble of the partial maps written by a shard.
+struct ShardHeader
+{
+	Shard shard;
+	// The rectangle in which the maps were created, see extendMap.
+	sf::IntRect cropRect;
+	// Frames that take the map of an earlier frame.
+	struct ReusedFrame
+	{
+		int frame;
+		int source;
+	};
+	std::vector<ReusedFrame> reusedFrames;
+};
+
+// Combine the partial maps of all shards into the complete maps. Reused frames are derived
+// again from the merged maps. Returns an empty list if the shards do not cover all targets.
+std::vector<TransferMap> mergeShards(const std::vector<ShardHeader>& _headers,
+	const std::vector<std::vector<TransferMap>>& _shardMaps);
+
+// The maps of one frame together with the hash of the inputs that they were created from.
+void writeCheckpoint(std::ostream& _out, std::uint64_t _hash, const std::vector<TransferMap>& _maps);
+// @return False if _in is not a complete checkpoint of _hash with maps of _size.
+bool readCheckpoint(std::istream& _in, std::uint64_t _hash, sf::Vector2u _size, std::vector<TransferMap>& _maps);
+
+// Per pixel flags, e.g. to select which targets are searched. Nonzero means set.
+using PixelMask = math::Matrix<sf::Uint8>;
+
+// Optional inputs and outputs of constructMap.
+struct MapSearchOptions
+{
+	// Only targets where the mask is set are searched. All others keep the value
+	// from initialMap or the identity if no initial map is given. Their confidence is 0.
+	const PixelMask* targetMask = nullptr;
+	const TransferMap* initialMap = nullptr;
+	// If set, the difference between the best and the second best candidate
+	// is stored for each target. It is infinite if there is only one candidate.
+	math::Matrix<float>* margin = nullptr;
+	// Sorted flat indices of the sources that are searched if no zone map is given.
+	// All sources are searched if not set.
+	const PixelList* candidates = nullptr;
+	// Map of a similar target, e.g. the previous frame of an animation. The sources
+	// close to its mapping of the target and of the neighbours are searched first.
+	// If the best of them has a distance of at most seedThreshold, the search stops.
+	// Otherwise it continues with the best seed as bound.
+	const TransferMap* seedMap = nullptr;
+	unsigned seedRadius = 1;
+	float seedThreshold = 0.f;
+	// Receives the issues with the inputs. If not set, they are printed once the map is done.
+	utils::Diagnostics* diagnostics = nullptr;
+};
+
+// Pixels where any of the images is not transparent, dilated by _radius.
+// The pixels within _radius of the border are included as well.
+PixelMask makeActiveMask(const std::vector<ImageView>& _images, unsigned _radius);
+
+// Flat indices of the pixels that are set in _mask.
+PixelList maskToPixelList(const PixelMask& _mask);
+
+namespace details {
+	template<typename Distance, typename = void>
+	struct HasPrior : std::false_type {};
+	template<typename Distance>
+	struct HasPrior<Distance, std::void_t<decltype(std::declval<const Distance&>().prior(0u, 0u))>> 
+		: std::true_type {};
+
+	// Candidate of a search. On equal distances, the identity and then the 
+	// lower flat index are preferred, which is the order of a row-major search.
+	struct Candidate
+	{
+		size_t index;
+		float distance;
+		bool isIdentity;
+
+		bool isWorse(size_t _index, float _distance) const
+		{
+			return _distance < distance 
+				|| (_distance == distance && !isIdentity && _index < index);
+		}
+	};
+
+	// The best candidate of a search and optionally the distance of the second best.
+	struct SearchResult
+	{
+		Candidate best;
+		bool trackSecond;
+		float second = std::numeric_limits<float>::infinity();
+
+		// Candidates with a larger distance can not change the result.
+		float bound() const { return trackSecond ? second : best.distance; }
+
+		void add(size_t _index, float _distance)
+		{
+			if (best.isWorse(_index, _distance))
+			{
+				second = std::min(second, best.distance);
+				best = Candidate{ _index, _distance, false };
+			}
+			else if (_index != best.index)
+				second = std::min(second, _distance);
+		}
+	};
+
+	// Target pixels that share the same zone as flat indices in row-major order.
+	struct ZoneTargets
+	{
+		const PixelList* zone;
+		std::vector<size_t> targets;
+	};
+
+	// Group all target pixels of _zoneMap by their zone. Large groups are split into 
+	// units of at most _maxTargets pixels. The units are sorted by descending cost,
+	// so that they can be distributed well as tasks.
+	std::vector<ZoneTargets> groupTargetsByZone(const ZoneMap& _zoneMap, size_t _maxTargets = 64);
+
+	// Evaluate the sources around the mapping of (x,y) and its 8 neighbours in _seedMap.
+	// The mapping of a neighbour is shifted by the offset from the neighbour to (x,y).
+	// @param _isCandidate Whether a flat index is part of the search space.
+	template<typename TargetDistance, typename IsCandidate>
+	void searchSeeds(const TargetDistance& _distance,
+		const TransferMap& _seedMap,
+		unsigned x, unsigned y,
+		int _radius,
+		IsCandidate _isCandidate,
+		SearchResult& _result)
+	{
+		const sf::Vector2i size(_seedMap.size);
+		for (int ny = static_cast<int>(y) - 1; ny <= static_cast<int>(y) + 1; ++ny)
+			for (int nx = static_cast<int>(x) - 1; nx <= static_cast<int>(x) + 1; ++nx)
+			{
+				if (nx < 0 || ny < 0 || nx >= size.x || ny >= size.y)
+					continue;
+				const sf::Vector2i seed = sf::Vector2i(_seedMap(nx, ny)) + sf::Vector2i(x - nx, y - ny);
+				for (int iy = std::max(seed.y - _radius, 0); iy <= std::min(seed.y + _radius, size.y - 1); ++iy)
+					for (int ix = std::max(seed.x - _radius, 0); ix <= std::min(seed.x + _radius, size.x - 1); ++ix)
+					{
+						const size_t ind = _seedMap.flatIndex(ix, iy);
+						if (_isCandidate(ind))
+							_result.add(ind, _distance(sf::Vector2u(ix, iy), _result.bound()));
+					}
+			}
+	}
+
+	// Search all source pixels in rings of increasing Chebyshev distance around the prior.
+	// Stops once the lower bound of the distance exceeds the bound of the result.
+	template<typename DistanceMeasure, typename TargetDistance>
+	void searchFromPrior(const DistanceMeasure& _distanceMeasure,
+		const TargetDistance& _distance,
+		sf::Vector2u _prior,
+		const math::ArrayShape2D& _shape,
+		SearchResult& _result)
+	{
+		const sf::Vector2u size = _shape.size;
+		_prior.x = std::min(_prior.x, size.x - 1);
+		_prior.y = std::min(_prior.y, size.y - 1);
+		const unsigned maxRadius = std::max({ _prior.x, _prior.y, size.x - 1 - _prior.x, size.y - 1 - _prior.y });
+
+		auto check = [&](unsigned ix, unsigned iy)
+		{
+			_result.add(_shape.flatIndex(ix, iy), _distance(sf::Vector2u(ix, iy), _result.bound()));
+		};
+
+		for (unsigned r = 0; r <= maxRadius; ++r)
+		{
+			if (_distanceMeasure.lowerBound(r) > _result.bound())
+				break;
+
+			const unsigned minY = _prior.y > r ? _prior.y - r : 0u;
+			const unsigned maxY = std::min(_prior.y + r, size.y - 1);
+			const unsigned minX = _prior.x > r ? _prior.x - r : 0u;
+			const unsigned maxX = std::min(_prior.x + r, size.x - 1);
+			for (unsigned iy = minY; iy <= maxY; ++iy)
+			{
+				// full rows at the top and bottom of the ring, otherwise only the sides
+				if (iy + r == _prior.y || iy == _prior.y + r)
+				{
+					for (unsigned ix = minX; ix <= maxX; ++ix)
+						check(ix, iy);
+				}
+				else
+				{
+					if (_prior.x >= r)
+						check(_prior.x - r, iy);
+					if (r > 0 && _prior.x + r < size.x)
+						check(_prior.x + r, iy);
+				}
+			}
+		}
+	}
+}
+
 /* Constructs a map that transforms _src to _dst.
  * A distance measure should be a functor with the signature
  *		Matrix<float> operator()(unsigned x, unsigned y)
  * that determines how similar (x,y) is to each pixel in the destination image,
  * where 0 is a perfect match. See pixelsimilarity.hpp for implementations.
+ * The search itself only evaluates single candidates through forTarget(x,y).
+ * Measures with an analytic prior are searched outward from the prior.
+ * With a zone map, the targets are processed zone by zone.
  * @return The transfer map and a matrix with the final distance for each pixel.
  */
 template<typename DistanceMeasure>
 auto constructMap(const DistanceMeasure& _distanceMeasure,
 	const ZoneMap* _zoneMap = nullptr,
 	unsigned _numThreads = 1,
-	sf::Vector2u _originOffset = {})
+	sf::Vector2u _originOffset = {},
+	const MapSearchOptions& _options = {})
 	-> std::pair<TransferMap, math::Matrix<float>>
 {
 	const sf::Vector2u size = _distanceMeasure.getSize();
 	TransferMap map(size);
 	math::Matrix<float> confidence(size);
+	const bool trackSecond = _options.margin != nullptr;
+	if (trackSecond)
+		_options.margin->resize(size);
+	assert(!_options.targetMask || _options.targetMask->size == size);
+	assert(!_options.initialMap || _options.initialMap->size == size);
 
-	auto computeRows = [&](unsigned begin, unsigned end)
+	// zones are sorted, but a zone map can decide the membership directly
+	auto isInZone = [_zoneMap](const PixelList& _zone, size_t _ind, unsigned x, unsigned y)
 	{
-		for (unsigned y = begin; y < end; ++y)
+		return _zoneMap ? _zoneMap->sharesZone(_ind, x, y) : std::binary_search(_zone.begin(), _zone.end(), _ind);
+	};
+
+	utils::Diagnostics ownDiagnostics;
+	utils::Diagnostics& diagnostics = _options.diagnostics ? *_options.diagnostics : ownDiagnostics;
+
+	// @param _zone The candidates if restricted, otherwise nullptr.
+	// @param _issues Collects the issues of the current thread.
+	auto searchTarget = [&](unsigned x, unsigned y, const PixelList* _zone, utils::Diagnostics::Local& _issues)
+	{
+		if (_options.targetMask && !(*_options.targetMask)(x, y))
+		{
+			map(x, y) = _options.initialMap ? (*_options.initialMap)(x, y) : sf::Vector2u(x, y);
+			confidence(x, y) = 0.f;
+			if (trackSecond)
+				(*_options.margin)(x, y) = std::numeric_limits<float>::infinity();
+			return;
+		}
+
+		const auto distance = _distanceMeasure.forTarget(x, y);
+		// if the minimum is not unique prefer the identity
+		const size_t identityInd = map.flatIndex(x, y);
+		details::SearchResult result{ details::Candidate{ identityInd, 0.f, true }, trackSecond };
+
+		if (_zone)
 		{
-			for (unsigned x = 0; x < size.x; ++x)
+			if (_zone->empty() && _zoneMap)
 			{
-				const auto distance = _distanceMeasure(x, y);
-				// if the minimum is not unique prefer the identity
-				size_t minInd = distance.flatIndex(x, y);
+				_issues.add(utils::Diagnostics::Kind::MissingZone, utils::Diagnostics::Input::Target,
+					(*_zoneMap).getDst().getPixel(x, y), sf::Vector2u(x, y));
+			}
+			// identity is not part of the zone
+			else if (!_zone->empty() && !isInZone(*_zone, identityInd, x, y))
+				result.best = details::Candidate{ _zone->front(), 0.f, false };
+		}
+		result.best.distance = distance(map.index(result.best.index));
 
-				if (_zoneMap)
-				{
-					const PixelList& zone = (*_zoneMap)(x,y);
-					if (zone.empty())
-					{
-						const sf::Color col = (*_zoneMap).getDst().getPixel(x, y);
-						std::cout << "[Warning] Zone map is invalid. The color (" << col
-							<< ") at (" << _originOffset.x + x << ", " << _originOffset.y + y << ") does not exist in the reference.\n";
-					}
-					else
-					{
-						// identity is not part of the zone
-						if (std::find(zone.begin(), zone.end(), minInd) == zone.end())
-							minInd = zone.front();
-						auto minEl = distance[minInd];
-						for (size_t ind : zone)
-							if (distance[ind] < minEl)
-							{
-								minEl = distance[ind];
-								minInd = ind;
-							}
-					}
-				}
-				else
+		if (_options.seedMap)
+		{
+			details::searchSeeds(distance, *_options.seedMap, x, y, _options.seedRadius,
+				[&](size_t _ind)
 				{
-					auto minEl = std::min_element(distance.begin(), distance.end());
-					if (*minEl < distance(x, y))
-						minInd = std::distance(distance.begin(), minEl);
-				}
+					return !_zone || isInZone(*_zone, _ind, x, y);
+				}, result);
+		}
 
-				map(x, y) = distance.index(minInd);
-				confidence(x, y) = distance[minInd];
+		// a good enough seed ends the search early; otherwise the order of 
+		// the candidates does not change the result
+		const bool isSeeded = _options.seedMap && result.best.distance <= _options.seedThreshold;
+		if (!isSeeded)
+		{
+			if (_zone)
+			{
+				for (size_t ind : *_zone)
+					result.add(ind, distance(map.index(ind), result.bound()));
+			}
+			else if constexpr (details::HasPrior<DistanceMeasure>::value)
+			{
+				details::searchFromPrior(_distanceMeasure, distance, _distanceMeasure.prior(x, y), map, result);
+			}
+			else
+			{
+				for (unsigned iy = 0; iy < size.y; ++iy)
+					for (unsigned ix = 0; ix < size.x; ++ix)
+						result.add(map.flatIndex(ix, iy), distance(sf::Vector2u(ix, iy), result.bound()));
 			}
 		}
+
+		map(x, y) = map.index(result.best.index);
+		confidence(x, y) = result.best.distance;
+		if (trackSecond)
+			(*_options.margin)(x, y) = result.second - result.best.distance;
 	};
 
-	utils::runMultiThreaded(0u, size.y, computeRows, _numThreads);
+	if (_zoneMap)
+	{
+		// zone-major: all targets of a zone are searched together so that the 
+		// candidates of the zone stay in cache
+		const std::vector<details::ZoneTargets> zones = details::groupTargetsByZone(*_zoneMap);
+		utils::runMultiThreaded(size_t(0), zones.size(), [&](size_t begin, size_t end)
+			{
+				utils::Diagnostics::Local issues(diagnostics);
+				for (size_t i = begin; i < end; ++i)
+					for (size_t target : zones[i].targets)
+					{
+						const sf::Vector2u pos = map.index(target);
+						searchTarget(pos.x, pos.y, zones[i].zone, issues);
+					}
+			}, _numThreads);
+	}
+	else
+	{
+		// a restricted candidate set is searched in the same way as a zone
+		utils::runMultiThreaded(0u, size.y, [&](unsigned begin, unsigned end)
+			{
+				utils::Diagnostics::Local issues(diagnostics);
+				for (unsigned y = begin; y < end; ++y)
+					for (unsigned x = 0; x < size.x; ++x)
+						searchTarget(x, y, _options.candidates, issues);
+			}, _numThreads);
+	}
+
+	if (!_options.diagnostics)
+		ownDiagnostics.print(std::cout, _originOffset);
 
 	return { map, confidence };
 }
 
+class AnyDistance;
+
+// Construct one map for each distance measure with a single traversal of the candidates.
+// The results are the same as from constructMap with each measure on its own.
+// Analytic measures are searched over all candidates instead of outward from their prior.
+// The margin and seedMap of _options are not supported.
+std::vector<std::pair<TransferMap, math::Matrix<float>>> constructMaps(
+	const std::vector<AnyDistance>& _distanceMeasures,
+	const ZoneMap* _zoneMap = nullptr,
+	unsigned _numThreads = 1,
+	sf::Vector2u _originOffset = {},
+	const MapSearchOptions& _options = {});
+
 // direct visualization of a TransferMap where distances are color coded
 sf::Image distanceMap(const TransferMap& _transferMap);
 
 // Create an image with a color gradient in both x and y direction such that each pixel
 // has a unique color.
 // @param _reference An image that determines the size and is integrated to be somewhat visible.
-sf::Image makeColorGradientImage(const sf::Image& _reference, bool _rgb = true);
+sf::Image makeColorGradientImage(const ImageView& _reference, bool _rgb = true);
 // visualize by applying the map to a high contrast image
 sf::Image colorMap(const TransferMap& _transferMap, const sf::Image& _reference, bool _rgb = true);
 
@@ -149,4 +525,6 @@ sf::Image matToImage(const math::Matrix<float>& _mat);
 
 // serialization
 std::ostream& operator<<(std::ostream& _out, const TransferMap& _transferMap);
-std::istream& operator>>(std::istream& _in, TransferMap& _transferMap);
\ No newline at end of file
+std::istream& operator>>(std::istream& _in, TransferMap& _transferMap);
+std::ostream& operator<<(std::ostream& _out, const ShardHeader& _header);
+std::istream& operator>>(std::istream& _in, ShardHeader& _header);
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "optim.hpp"
 #include "../math/vectorext.hpp"
 #include <random>
+#include <mutex>
 
 namespace nn {
 
@@ -223,14 +224,13 @@ namespace nn {
 
 		using namespace details;
 
-		// torch does not like calling these functions twice
-		static bool init = false;
-		if (!init)
+		// torch does not like calling these functions twice; frames may run concurrently
+		static std::once_flag init;
+		std::call_once(init, []()
 		{
 			torch::set_num_threads(1);
 			torch::set_num_interop_threads(1);
-			init = true;
-		}
+		});
 
 		struct Task
 		{
@@ -495,13 +495,12 @@ namespace nn {
 			}
 		};
 
-		std::vector<std::thread> threads;
-		for (unsigned i = 1; i < _numThreads; ++i)
-		{
-			threads.emplace_back(executeOptim);
-		}
+		// executeOptim takes zones until none are left
+		utils::TaskGroup workers;
+		for (unsigned i = 1; i < std::min(_numThreads, utils::ThreadPool::get().numThreads()); ++i)
+			workers.run(executeOptim);
 		executeOptim();
-		for (auto& t : threads) t.join();
+		workers.wait();
 
 		return map;
 	}
@@ -2,200 +2,653 @@
 #include "../math/vectorext.hpp"
 #include "../utils/colors.hpp"
 #include <unordered_set>
+#include <algorithm>
 #include <array>
 #include <optional>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 using sf::Vector2u;
-using PixelChain = std::vector<Vector2u>;
+
+// Remaining pixels of a zone with a lookup grid over their bounding box, so that the
+// nearest pixel is found by looking at the rings around a position.
+class RemainingPixels
+{
+public:
+	explicit RemainingPixels(std::vector<Vector2u> _pixels)
+		: m_pixels(std::move(_pixels))
+	{
+		m_min = m_pixels.front();
+		Vector2u max = m_min;
+		for (const Vector2u& p : m_pixels)
+		{
+			m_min.x = std::min(m_min.x, p.x);
+			m_min.y = std::min(m_min.y, p.y);
+			max.x = std::max(max.x, p.x);
+			max.y = std::max(max.y, p.y);
+		}
+		m_size = max - m_min + Vector2u(1, 1);
+		m_slots.resize(static_cast<size_t>(m_size.x) * m_size.y, NONE);
+		for (size_t i = 0; i < m_pixels.size(); ++i)
+			slot(m_pixels[i]) = i;
+	}
+
+	bool empty() const { return m_pixels.empty(); }
+	const Vector2u& operator[](size_t _slot) const { return m_pixels[_slot]; }
+
+	// Remove a pixel by moving the last one into its slot.
+	void remove(size_t _slot)
+	{
+		slot(m_pixels[_slot]) = NONE;
+		if (_slot + 1 != m_pixels.size())
+		{
+			m_pixels[_slot] = m_pixels.back();
+			slot(m_pixels[_slot]) = _slot;
+		}
+		m_pixels.pop_back();
+	}
+
+	// The slot and squared distance of the pixel closest to _origin.
+	// Among equally close pixels the lowest slot is taken, or the first one in
+	// row-major order if _rowMajorTies is set.
+	std::pair<size_t, size_t> nearest(Vector2u _origin, bool _rowMajorTies = false) const
+	{
+		size_t bestSlot = NONE;
+		size_t bestDist = std::numeric_limits<size_t>::max();
+		auto check = [&](int x, int y)
+		{
+			const size_t i = m_slots[x + static_cast<size_t>(y) * m_size.x];
+			if (i == NONE)
+				return;
+			const size_t d = math::distSq(_origin, m_pixels[i]);
+			if (d < bestDist || (d == bestDist && (_rowMajorTies ? isBefore(m_pixels[i], m_pixels[bestSlot]) : i < bestSlot)))
+			{
+				bestDist = d;
+				bestSlot = i;
+			}
+		};
+
+		// origin relative to the grid, it can be outside
+		const int ox = static_cast<int>(_origin.x) - static_cast<int>(m_min.x);
+		const int oy = static_cast<int>(_origin.y) - static_cast<int>(m_min.y);
+		const int w = static_cast<int>(m_size.x);
+		const int h = static_cast<int>(m_size.y);
+		const int maxRadius = std::max({ std::abs(ox), std::abs(ox - w + 1), std::abs(oy), std::abs(oy - h + 1) });
+		for (int r = 0; r <= maxRadius; ++r)
+		{
+			// pixels in ring r are at least r away
+			if (static_cast<size_t>(r) * r > bestDist)
+				break;
+			const int minY = std::max(oy - r, 0);
+			const int maxY = std::min(oy + r, h - 1);
+			for (int y = minY; y <= maxY; ++y)
+			{
+				// full rows at the top and bottom of the ring, otherwise only the sides
+				if (y == oy - r || y == oy + r)
+				{
+					for (int x = std::max(ox - r, 0); x <= std::min(ox + r, w - 1); ++x)
+						check(x, y);
+				}
+				else
+				{
+					if (ox - r >= 0 && ox - r < w)
+						check(ox - r, y);
+					if (r > 0 && ox + r >= 0 && ox + r < w)
+						check(ox + r, y);
+				}
+			}
+		}
+		return { bestSlot, bestDist };
+	}
+private:
+	static constexpr size_t NONE = std::numeric_limits<size_t>::max();
+	static bool isBefore(const Vector2u& _a, const Vector2u& _b) { return _a.y < _b.y || (_a.y == _b.y && _a.x < _b.x); }
+	size_t& slot(const Vector2u& _pos) { return m_slots[(_pos.x - m_min.x) + static_cast<size_t>(_pos.y - m_min.y) * m_size.x]; }
+
+	std::vector<Vector2u> m_pixels;
+	// slot in m_pixels of each position in the bounding box
+	std::vector<size_t> m_slots;
+	Vector2u m_min;
+	Vector2u m_size;
+};
 
 // @param _refMap A matrix of correct size to compute x,y coordinates of pixels.
 PixelChain makePixelChainGreedy(const PixelList& _pixels, 
 	const TransferMap& _refMap)
 {
-	std::vector<Vector2u> remainingPixels;
-	remainingPixels.reserve(_pixels.size());
+	std::vector<Vector2u> positions;
+	positions.reserve(_pixels.size());
 	for (size_t p : _pixels)
-		remainingPixels.emplace_back(_refMap.index(p));
+		positions.emplace_back(_refMap.index(p));
 
 	// use deque because we build chains starting from a random point
-	std::deque<Vector2u> pixelChain {remainingPixels.back()};
-	remainingPixels.pop_back();
-
-	std::vector<size_t> frontDists;
-	std::vector<size_t> backDists;
-
-	auto updateDists = [&](Vector2u o, std::vector<size_t>& dists) 
-	{
-		dists.clear();
-		for (Vector2u p : remainingPixels)
-			dists.push_back(math::distSq(o, p));
-	};
+	std::deque<Vector2u> pixelChain {positions.back()};
+	RemainingPixels remainingPixels(std::move(positions));
+	remainingPixels.remove(_pixels.size() - 1);
 
 	while (!remainingPixels.empty()) 
 	{
-		updateDists(pixelChain.front(), frontDists);
-		updateDists(pixelChain.back(), backDists);
-
-		auto frontDistIt = std::min_element(frontDists.begin(), frontDists.end());
-		auto backDistIt = std::min_element(backDists.begin(), backDists.end());
+		const auto [frontIdx, frontDist] = remainingPixels.nearest(pixelChain.front());
+		const auto [backIdx, backDist] = remainingPixels.nearest(pixelChain.back());
 
 		size_t idx = 0;
-		if (*frontDistIt <= *backDistIt){
-			idx = std::distance(frontDists.begin(), frontDistIt);
+		if (frontDist <= backDist){
+			idx = frontIdx;
 			pixelChain.push_front(remainingPixels[idx]);
 		} else {
-			idx = std::distance(backDists.begin(), backDistIt);
+			idx = backIdx;
 			pixelChain.push_back(remainingPixels[idx]);
 		}
 
-		// remove pixel by moving it to the end since the order does not matter
-		remainingPixels[idx] = remainingPixels.back();
-		remainingPixels.pop_back();
+		// the order of the remaining pixels does not matter
+		remainingPixels.remove(idx);
 	}
 
 	return PixelChain(pixelChain.begin(), pixelChain.end());
 }
 
+// Walks from _start to the closest remaining pixel until all pixels are used. 
+// This is one of the chains of the exhaustive search, so it can be taken as 
+// its first result.
+// @param _start Index in _pixels of the first pixel.
+PixelChain makePixelChainFromStart(const PixelList& _pixels,
+	const TransferMap& _refMap,
+	size_t _start)
+{
+	std::vector<Vector2u> positions;
+	positions.reserve(_pixels.size());
+	for (size_t p : _pixels)
+		positions.emplace_back(_refMap.index(p));
+
+	PixelChain pixelChain{ positions[_start] };
+	pixelChain.reserve(_pixels.size());
+	RemainingPixels remainingPixels(std::move(positions));
+	remainingPixels.remove(_start);
+	while (!remainingPixels.empty())
+	{
+		// the search takes the first of equally close pixels in the sorted pixel list
+		const size_t idx = remainingPixels.nearest(pixelChain.back(), true).first;
+		pixelChain.push_back(remainingPixels[idx]);
+		remainingPixels.remove(idx);
+	}
+
+	return pixelChain;
+}
+
+// Length of _chain with the steps added in the same order as in the search.
+static float chainLength(const PixelChain& _chain)
+{
+	float length = 0.f;
+	for (size_t i = 1; i < _chain.size(); ++i)
+		length += std::sqrt(static_cast<float>(math::distSq(_chain[i - 1], _chain[i])));
+	return length;
+}
+
 // ************************************************************* //
-struct ChainTreeNode
+// Orders the pixels of a thin line by walking along it from _start.
+// A diagonal step that skips a corner pixel is never part of the shortest chain,
+// since the corner could then only be reached with a jump. Without these steps,
+// the pixels of a valid line form a simple path which is the only chain without jumps.
+// @param _start Index in _pixels of the first pixel. It has to be an end of the line.
+// @return nullopt if the zone is not a line ending in _start. The exhaustive search
+//		is needed in that case.
+std::optional<PixelChain> makePixelChainOnLine(const PixelList& _pixels, 
+	const TransferMap& _refMap,
+	size_t _start)
 {
-	Vector2u pos;
-	float length;
-	std::vector<bool> remainingPixels;
-	const ChainTreeNode* parent;
-	std::vector<ChainTreeNode> childs;
+	const size_t numPixels = _pixels.size();
+	const sf::Vector2i size(_refMap.size);
+	// the pixel list is sorted
+	auto find = [&](int x, int y)
+	{
+		if (x < 0 || y < 0 || x >= size.x || y >= size.y)
+			return numPixels;
+		const size_t flat = x + static_cast<size_t>(y) * size.x;
+		const auto it = std::lower_bound(_pixels.begin(), _pixels.end(), flat);
+		return it != _pixels.end() && *it == flat ? static_cast<size_t>(it - _pixels.begin()) : numPixels;
+	};
+
+	// the at most two neighbours of each pixel on the line
+	std::vector<std::array<size_t, 2>> neighbours(numPixels, { numPixels, numPixels });
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		const sf::Vector2i pos(_refMap.index(_pixels[i]));
+		size_t degree = 0;
+		for (int dy = -1; dy <= 1; ++dy)
+			for (int dx = -1; dx <= 1; ++dx)
+			{
+				if (!dx && !dy)
+					continue;
+				const size_t j = find(pos.x + dx, pos.y + dy);
+				if (j == numPixels)
+					continue;
+				if (dx && dy && (find(pos.x + dx, pos.y) != numPixels || find(pos.x, pos.y + dy) != numPixels))
+					continue;
+				// a branch or a cluster
+				if (degree == 2)
+					return std::nullopt;
+				neighbours[i][degree++] = j;
+			}
+	}
+	if (neighbours[_start][1] != numPixels)
+		return std::nullopt;
+
+	PixelChain pixelChain;
+	pixelChain.reserve(numPixels);
+	size_t prev = numPixels;
+	size_t current = _start;
+	while (current != numPixels)
+	{
+		pixelChain.push_back(_refMap.index(_pixels[current]));
+		const auto [a, b] = neighbours[current];
+		const size_t next = a != prev ? a : b;
+		prev = current;
+		current = next;
+	}
+	// the line consists of multiple parts
+	if (pixelChain.size() != numPixels)
+		return std::nullopt;
+
+	return pixelChain;
+}
+
+// ************************************************************* //
+// Set of pixel indices with one bit per pixel.
+class PixelBitset
+{
+public:
+	explicit PixelBitset(size_t _size) : m_words((_size + WORD_BITS - 1) / WORD_BITS, 0) {}
+
+	void set(size_t _idx) { m_words[_idx / WORD_BITS] |= bit(_idx); }
+	void reset(size_t _idx) { m_words[_idx / WORD_BITS] &= ~bit(_idx); }
+
+	// Call _fn for each set index in ascending order. Empty words are skipped.
+	template<typename Fn>
+	void forEach(Fn _fn) const
+	{
+		for (size_t w = 0; w < m_words.size(); ++w)
+		{
+			size_t idx = w * WORD_BITS;
+			for (std::uint64_t word = m_words[w]; word; word >>= 1, ++idx)
+				if (word & 1)
+					_fn(idx);
+		}
+	}
+private:
+	static constexpr size_t WORD_BITS = 64;
+	static std::uint64_t bit(size_t _idx) { return std::uint64_t(1) << (_idx % WORD_BITS); }
+
+	std::vector<std::uint64_t> m_words;
 };
 
-static ChainTreeNode makeTreeNode(Vector2u _pos, const std::vector<bool>& _remaining, size_t _idx, ChainTreeNode* _parent)
+// The length of the shortest chain found so far and the subtree of the search in which
+// it was found, packed into one atomic value. On equal length the lower subtree wins,
+// which is the chain that a sequential search would have found first.
+class ChainBound
 {
-	std::vector<bool> remaining = _remaining;
-	remaining[_idx] = false;
-	const float length = _parent ? _parent->length + std::sqrt(static_cast<float>(math::distSq(_parent->pos, _pos))) : 0.f;
-	
-	return ChainTreeNode {
-		_pos,
-		length,	
-		std::move(remaining),
-		_parent
+public:
+	// Non-negative floats have the same order as their bits.
+	static std::uint64_t pack(float _length, size_t _subtree)
+	{
+		std::uint32_t bits;
+		std::memcpy(&bits, &_length, sizeof(bits));
+		return (static_cast<std::uint64_t>(bits) << 32) | static_cast<std::uint32_t>(_subtree);
+	}
+
+	std::uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+	void update(std::uint64_t _value)
+	{
+		std::uint64_t current = get();
+		while (_value < current && !m_value.compare_exchange_weak(current, _value, std::memory_order_relaxed)) {}
+	}
+private:
+	std::atomic<std::uint64_t> m_value = std::numeric_limits<std::uint64_t>::max();
+};
+
+// Subtree of a chain that is known before the search. Chains of the same length 
+// that are found by the search are preferred.
+constexpr size_t INITIAL_SUBTREE = std::numeric_limits<std::uint32_t>::max();
+
+// State that is shared by the searches of all subtrees.
+struct ChainSearchShared
+{
+	explicit ChainSearchShared(std::vector<Vector2u> _positions)
+		: positions(std::move(_positions))
+	{}
+
+	const std::vector<Vector2u> positions;
+	ChainBound bound;
+	// time limit of the current run
+	std::chrono::high_resolution_clock::time_point startTime;
+	float maxTimeInSec = 0.f;
+	std::atomic<bool> hadTimeout = false;
+};
+
+// Depth-first search for the shortest chain below a fixed prefix. Only the current 
+// chain is stored; the remaining pixels are updated when stepping in and out.
+class ChainSearch
+{
+public:
+	explicit ChainSearch(ChainSearchShared& _shared)
+		: m_shared(_shared),
+		m_numPixels(_shared.positions.size()),
+		m_remaining(m_numPixels)
+	{}
+
+	// Prepare the search of all chains that begin with _prefix. The subtrees are numbered
+	// in the order in which a sequential search would visit them.
+	void start(const std::vector<size_t>& _prefix, size_t _subtree);
+	// Continue the search until it is finished or the time limit is reached. The search 
+	// can be continued later with the same result as without the interruption.
+	void resume();
+	bool isFinished() const { return m_path.size() < m_prefixSize; }
+
+	// The pixels that can follow _prefix in the order in which they are searched.
+	std::vector<size_t> successors(const std::vector<size_t>& _prefix);
+
+	// packed length and subtree of the best chain found by this search, see ChainBound
+	std::uint64_t shortest = std::numeric_limits<std::uint64_t>::max();
+	std::vector<size_t> shortestPath;
+private:
+	struct Step
+	{
+		size_t pixel;
+		float length;
+		// unexplored successors in m_children
+		size_t childBegin;
+		size_t childEnd;
 	};
+
+	void resetRemaining(const std::vector<size_t>& _prefix);
+	// Append the direct neighbours of _pixel to m_children or the closest pixel if there are none.
+	// @param _withClosest Only add the closest pixel if this is set.
+	void addChildren(size_t _pixel, bool _withClosest);
+	// Take _pixel as the next pixel of the chain.
+	// @return False if the chain is finished or can not become shorter than the best one.
+	bool stepIn(size_t _pixel, float _length);
+	float stepLength(size_t _from, size_t _to) const
+	{
+		const std::vector<Vector2u>& positions = m_shared.positions;
+		return std::sqrt(static_cast<float>(math::distSq(positions[_from], positions[_to])));
+	}
+
+	ChainSearchShared& m_shared;
+	size_t m_numPixels;
+	size_t m_subtree = 0;
+	size_t m_prefixSize = 0;
+	std::vector<Step> m_path;
+	std::vector<size_t> m_children;
+	PixelBitset m_remaining;
+};
+
+void ChainSearch::resetRemaining(const std::vector<size_t>& _prefix)
+{
+	for (size_t i = 0; i < m_numPixels; ++i)
+		m_remaining.set(i);
+	for (size_t pixel : _prefix)
+		m_remaining.reset(pixel);
 }
 
-// @param _refMap A matrix of correct size to compute x,y coordinates of pixels.
-// @outParam _hadTimout Signals the caller that the search has not finished because
-//		the time limit was reached. 
-PixelChain makePixelChain(const PixelList& _pixels, 
-	const TransferMap& _refMap,
-	float _maxTimeInSec,
-	bool& _hadTimeout)
+void ChainSearch::addChildren(size_t _pixel, bool _withClosest)
 {
-	std::vector<Vector2u> positions;
-	positions.reserve(_pixels.size());
-	for (size_t p : _pixels)
-		positions.push_back(_refMap.index(p));
+	const std::vector<Vector2u>& positions = m_shared.positions;
+	const size_t childBegin = m_children.size();
+	unsigned minDist = std::numeric_limits<unsigned>::max();
+	size_t minIdx = std::numeric_limits<size_t>::max();
+	m_remaining.forEach([&](size_t i)
+		{
+			// 1-ring neighborhood
+			const unsigned dSq = math::distSq(positions[_pixel], positions[i]);
+			if (dSq <= 2)
+				m_children.push_back(i);
+			else if (dSq < minDist)
+			{
+				minDist = dSq;
+				minIdx = i;
+			}
+		});
 
-	const size_t start_mark_idx = _pixels.marks.front().idx;
+	// choose closest pixel if there are no direct neighbor
+	if (_withClosest && m_children.size() == childBegin && minIdx < m_numPixels)
+		m_children.push_back(minIdx);
+}
 
-	ChainTreeNode tree = makeTreeNode(positions[start_mark_idx], 
-		std::vector<bool>(_pixels.size(), true), 
-		start_mark_idx,
-		nullptr);
+bool ChainSearch::stepIn(size_t _pixel, float _length)
+{
+	m_remaining.reset(_pixel);
+	const size_t numRemaining = m_numPixels - m_path.size() - 1;
+	const size_t childBegin = m_children.size();
 
-	std::vector<ChainTreeNode*> activeNodes { &tree };
+	// pruning: stop path if it can not become shorter than the best chain of all searches
+	const bool isPruned = m_shared.bound.get() <= ChainBound::pack(_length + numRemaining, m_subtree);
+	addChildren(_pixel, !isPruned);
 
-	ChainTreeNode* shortestPath = nullptr;
+	if (isPruned || m_children.size() == childBegin)
+	{
+		// chain is finished
+		const std::uint64_t value = ChainBound::pack(_length, m_subtree);
+		if (!isPruned && value < m_shared.bound.get())
+		{
+			shortest = value;
+			shortestPath.clear();
+			for (const Step& step : m_path)
+				shortestPath.push_back(step.pixel);
+			shortestPath.push_back(_pixel);
+			m_shared.bound.update(value);
+		}
+		m_children.resize(childBegin);
+		m_remaining.set(_pixel);
+		return false;
+	}
 
-	using namespace std::chrono;
-	const auto startTime = high_resolution_clock::now();
+	m_path.push_back(Step{ _pixel, _length, childBegin, m_children.size() });
+	return true;
+}
 
+void ChainSearch::start(const std::vector<size_t>& _prefix, size_t _subtree)
+{
+	m_subtree = _subtree;
+	m_prefixSize = _prefix.size();
+	m_path.clear();
+	m_children.clear();
+	resetRemaining({});
+
+	// the other successors of the prefix belong to other subtrees
+	float length = 0.f;
+	for (size_t i = 0; i + 1 < _prefix.size(); ++i)
+	{
+		m_remaining.reset(_prefix[i]);
+		m_path.push_back(Step{ _prefix[i], length, 0, 0 });
+		length += stepLength(_prefix[i], _prefix[i + 1]);
+	}
+	stepIn(_prefix.back(), length);
+}
+
+void ChainSearch::resume()
+{
+	using namespace std::chrono;
 	int iterations = 0;
-	while (!activeNodes.empty())
+	while (!isFinished())
 	{
+		Step& step = m_path.back();
+		if (step.childBegin == step.childEnd)
+		{
+			// all successors are explored
+			m_children.resize(step.childBegin);
+			m_remaining.set(step.pixel);
+			m_path.pop_back();
+			continue;
+		}
+
 		// search takes too long (worst case is in O(n^8)
 		++iterations;
 		if (iterations % 65536 == 0)
 		{
-			const auto currentTime = high_resolution_clock::now();
-			const auto t = duration<float>(currentTime - startTime);
-			if (t.count() >= _maxTimeInSec) 
-			{
-				_hadTimeout = true;
-				break;
-			}
+			const auto t = duration<float>(high_resolution_clock::now() - m_shared.startTime);
+			if (t.count() >= m_shared.maxTimeInSec)
+				m_shared.hadTimeout = true;
 		}
+		if (m_shared.hadTimeout)
+			return;
 
-		ChainTreeNode& node = *activeNodes.back();
-		activeNodes.pop_back();
-		
-		unsigned minDist = std::numeric_limits<unsigned>::max();
-		size_t minIdx = std::numeric_limits<size_t>::max();
-		int numRemaining = 0;
+		// the last successor first, which is the order of the previous explicit tree search
+		const size_t next = m_children[--step.childEnd];
+		stepIn(next, step.length + stepLength(step.pixel, next));
+	}
+}
 
-		for (size_t i = 0; i < node.remainingPixels.size(); ++i)
+std::vector<size_t> ChainSearch::successors(const std::vector<size_t>& _prefix)
+{
+	resetRemaining(_prefix);
+	m_children.clear();
+	addChildren(_prefix.back(), true);
+	return std::vector<size_t>(m_children.rbegin(), m_children.rend());
+}
+
+// Search for the shortest chain that begins with the start marker. The search tree is
+// split into subtrees that are searched in parallel. The result is the same as with a 
+// single thread and it does not depend on how often the search is interrupted.
+class PixelChainSearch
+{
+public:
+	// @param _refMap A matrix of correct size to compute x,y coordinates of pixels.
+	// @param _initialChain A chain of _pixels from the start marker, e.g. from 
+	//		makePixelChainFromStart, that bounds the search from the beginning. It is the 
+	//		result until the search finds a shorter chain. If it is empty, the search has 
+	//		no initial bound and falls back to the greedy chain.
+	PixelChainSearch(const PixelList& _pixels, 
+		const TransferMap& _refMap,
+		PixelChain _initialChain,
+		unsigned _numThreads);
+
+	PixelChainSearch(const PixelChainSearch&) = delete;
+	PixelChainSearch& operator=(const PixelChainSearch&) = delete;
+
+	// Continue the search for at most _maxTimeInSec.
+	// @return True if the search is finished.
+	bool run(float _maxTimeInSec);
+	// The shortest chain found so far.
+	PixelChain result() const;
+	// Time that the search has run so far, from the start of the first subtree of a
+	// run to the end of the last one. Waiting for a free thread is not included.
+	float timeInSec() const { return m_timeInSec; }
+private:
+	const PixelList& m_pixels;
+	const TransferMap& m_refMap;
+	PixelChain m_initialChain;
+	unsigned m_numThreads;
+	ChainSearchShared m_shared;
+	// one search for each subtree
+	std::vector<ChainSearch> m_searches;
+	float m_timeInSec = 0.f;
+};
+
+PixelChainSearch::PixelChainSearch(const PixelList& _pixels,
+	const TransferMap& _refMap,
+	PixelChain _initialChain,
+	unsigned _numThreads)
+	: m_pixels(_pixels),
+	m_refMap(_refMap),
+	m_initialChain(std::move(_initialChain)),
+	m_numThreads(_numThreads),
+	m_shared([&]()
 		{
-			if (node.remainingPixels[i])
+			std::vector<Vector2u> positions;
+			positions.reserve(_pixels.size());
+			for (size_t p : _pixels)
+				positions.push_back(_refMap.index(p));
+			return positions;
+		}())
+{
+	if (!m_initialChain.empty())
+		m_shared.bound.update(ChainBound::pack(chainLength(m_initialChain), INITIAL_SUBTREE));
+
+	// Expand the top of the tree until there are enough subtrees to balance the work.
+	// Their order is kept, so that ties are resolved as in a sequential search.
+	std::vector<std::vector<size_t>> subtrees = { { _pixels.marks.front().idx } };
+	const size_t numSubtrees = _numThreads > 1 ? 8 * static_cast<size_t>(_numThreads) : 1;
+	{
+		ChainSearch expander(m_shared);
+		bool isExpanded = true;
+		while (subtrees.size() < numSubtrees && isExpanded)
+		{
+			isExpanded = false;
+			std::vector<std::vector<size_t>> next;
+			for (std::vector<size_t>& prefix : subtrees)
 			{
-				++numRemaining;
-				// 1-ring neighborhood
-				const unsigned dSq = math::distSq(node.pos, positions[i]);
-				if (dSq <= 2)
-					node.childs.push_back(makeTreeNode(positions[i], node.remainingPixels, i, &node));
-				else if (dSq < minDist)
+				const std::vector<size_t> successors = expander.successors(prefix);
+				if (successors.empty())
+					next.push_back(std::move(prefix));
+				for (size_t successor : successors)
 				{
-					minDist = dSq;
-					minIdx = i;
+					next.push_back(prefix);
+					next.back().push_back(successor);
 				}
+				isExpanded |= !successors.empty();
 			}
+			subtrees = std::move(next);
 		}
+	}
 
-		// pruning: stop path if it is already too long
-		if (shortestPath && shortestPath->length <= node.length + numRemaining)
-			continue;
+	m_searches.reserve(subtrees.size());
+	for (size_t i = 0; i < subtrees.size(); ++i)
+		m_searches.emplace_back(m_shared).start(subtrees[i], i);
+}
 
-		// choose closest pixel if there are no direct neighbor
-		if (node.childs.empty() && minIdx < _pixels.size())
-		{
-			node.childs.push_back(makeTreeNode(positions[minIdx], node.remainingPixels, minIdx, &node));
-			/*for (size_t i = 0; i < node.remainingPixels.size(); ++i)
-			{
-				if (node.remainingPixels[i])
-					node.childs.push_back(makeTreeNode(positions[i], node.remainingPixels, i, &node));
-			}*/
-		}
+bool PixelChainSearch::run(float _maxTimeInSec)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	m_shared.startTime = Clock::now();
+	m_shared.maxTimeInSec = _maxTimeInSec;
+	m_shared.hadTimeout = false;
 
-		// chain is finished
-		if (node.childs.empty())
+	std::vector<ChainSearch*> pending;
+	for (ChainSearch& search : m_searches)
+		if (!search.isFinished())
+			pending.push_back(&search);
+
+	Clock::time_point begin = Clock::time_point::max();
+	Clock::time_point end = Clock::time_point::min();
+	std::mutex timeMutex;
+	utils::runMultiThreaded(size_t(0), pending.size(), [&](size_t _begin, size_t _end)
 		{
-			if (!shortestPath || shortestPath->length > node.length)
-				shortestPath = &node;
-		} 
-		else
+			const Clock::time_point chunkBegin = Clock::now();
+			for (size_t i = _begin; i < _end; ++i)
+				pending[i]->resume();
+
+			std::scoped_lock lock(timeMutex);
+			begin = std::min(begin, chunkBegin);
+			end = std::max(end, Clock::now());
+		}, m_numThreads);
+	if (begin < end)
+		m_timeInSec += std::chrono::duration<float>(end - begin).count();
+
+	return std::all_of(m_searches.begin(), m_searches.end(), [](const ChainSearch& _search)
 		{
-			for (ChainTreeNode& n : node.childs)
-				activeNodes.push_back(&n);
-		}
-	}
+			return _search.isFinished();
+		});
+}
+
+PixelChain PixelChainSearch::result() const
+{
+	const ChainSearch* best = nullptr;
+	for (const ChainSearch& search : m_searches)
+		if (!search.shortestPath.empty() && (!best || search.shortest < best->shortest))
+			best = &search;
+
+	// nothing shorter than the initial chain
+	if (!best)
+		return m_initialChain.empty() ? makePixelChainGreedy(m_pixels, m_refMap) : m_initialChain;
 
 	// reconstruct chain
 	PixelChain pixelChain;
-	pixelChain.reserve(_pixels.size());
-
-	const ChainTreeNode* node = shortestPath;
-	// timeout before the first path was finished extremely unlikely
-	if (!node)
-	{
-		pixelChain = makePixelChainGreedy(_pixels, _refMap);
-	}
-	else
-	{
-		while (node)
-		{
-			pixelChain.push_back(node->pos);
-			node = node->parent;
-		}
-		// the root node should be the start
-		std::reverse(pixelChain.begin(), pixelChain.end());
-	}
+	pixelChain.reserve(best->shortestPath.size());
+	for (size_t idx : best->shortestPath)
+		pixelChain.push_back(m_shared.positions[idx]);
 
 	return pixelChain;
 }
@@ -203,10 +656,22 @@ PixelChain makePixelChain(const PixelList& _pixels,
 // ************************************************************* //
 // Marks the start pixel of a chain.
 constexpr sf::Uint8 START_ALPHA = 155;
+// Chains are identified by the color without the alpha channel, which holds the marks.
+static sf::Color opaque(sf::Color _color)
+{
+	_color.a = 255;
+	return _color;
+}
+
 // Looks for a start marker and reverses the chain if necessary.
+// @param _input The image of _sprite, to report issues.
 // @return True if the chain (now) starts with the marked pixel.
-bool ensureOrientation(PixelChain& _pixelChain, const sf::Image& _sprite)
+bool ensureOrientation(PixelChain& _pixelChain, const ImageView& _sprite,
+	utils::Diagnostics::Local& _diagnostics, utils::Diagnostics::Input _input)
 {
+	using Kind = utils::Diagnostics::Kind;
+	auto zoneColor = [&](Vector2u _pos) { return opaque(_sprite.getPixel(_pos.x, _pos.y)); };
+
 	auto startIt = _pixelChain.end();
 	for (auto it = _pixelChain.begin(); it != _pixelChain.end(); ++it)
 	{
@@ -215,9 +680,8 @@ bool ensureOrientation(PixelChain& _pixelChain, const sf::Image& _sprite)
 			// already found one
 			if (startIt != _pixelChain.end()) 
 			{
-				std::cout << "[Warning] Encountered multiple starting points in a chain with color ("
-					<< col << "). First marker is at " << startIt->x << ", " << startIt->y
-					<< ". Additional marker found at " << it->x << ", " << it->y << ".\n";
+				_diagnostics.add(Kind::MultipleChainStarts, _input, zoneColor(*it), *startIt);
+				_diagnostics.add(Kind::MultipleChainStarts, _input, zoneColor(*it), *it);
 			}
 			else
 				startIt = it;
@@ -225,79 +689,267 @@ bool ensureOrientation(PixelChain& _pixelChain, const sf::Image& _sprite)
 	}
 	// not found
 	if (startIt == _pixelChain.end())
-	{
-	//	std::cout << "[Warning] No start marker found.\n";
 		return false;
-	}
 	// found but orientation is wrong
 	if (startIt == _pixelChain.end() - 1)
 		std::reverse(_pixelChain.begin(), _pixelChain.end());
 	else if (startIt != _pixelChain.begin()) // found but invalid
 	{
-		const sf::Color col = _sprite.getPixel(startIt->x, startIt->y);
-		std::cout << "[Warning] Pixel chain start marker is not at one of the ends in a chain with color ("
-					<< col << "). The marker was found at " << startIt->x << ", " << startIt->y << ".\n";
+		_diagnostics.add(Kind::MisplacedChainStart, _input, zoneColor(*startIt), *startIt);
 		return false;
 	}
 	return true;
 }
 
 // ************************************************************* //
-TransferMap constructMap(const sf::Image& _referenceSprite, 
-	const sf::Image& _targetSprite,
-	const ZoneMap& _srcZoneMap,
-	const ZoneMap& _dstZoneMap,
+// The chain of one zone and the state of its search.
+struct ChainTask
+{
+	const PixelList* pixels = nullptr;
+	PixelChain chain;
+	// kept between the rounds of makeChains to continue where the last round stopped
+	std::unique_ptr<PixelChainSearch> search;
+	bool needsSearch = false;
+	bool hadTimeout = false;  //< the search reached the time limit of the chain
+	bool hitDeadline = false; //< the search was stopped by the time budget
+	float searchTimeInSec = 0.f;
+};
+
+// Searches with less time than this are not started again.
+constexpr float MIN_SEARCH_TIME_IN_SEC = 0.01f;
+
+// Builds the chains of all _tasks. First, every zone gets a chain without a search.
+// Lines are ordered directly. With a time budget, other marked zones take the walk 
+// from the marker, which also bounds their search. Without one, the search is not
+// seeded and a zone falls back to the greedy chain if its search finds nothing, as
+// the single chain search did.
+// Then the remaining zones are searched within the time budget. Each search gets an 
+// equal share of the time that is left, so the time that easy zones do not need goes 
+// to the harder ones. Searches that did not finish are continued in the next round
+// as long as time is left.
+// @param _chainMaxTimeInSec Search time of each chain. 0 uses the greedy construction 
+//		and a negative value means no limit.
+// @param _timeBudgetInSec Time for all searches together. Negative means no limit.
+static void makeChains(std::vector<ChainTask>& _tasks, 
+	const TransferMap& _refMap,
+	float _chainMaxTimeInSec,
+	float _timeBudgetInSec,
+	unsigned _numThreads)
+{
+	using namespace std::chrono;
+	auto secondsSince = [](high_resolution_clock::time_point _time)
+	{
+		return duration<float>(high_resolution_clock::now() - _time).count();
+	};
+
+	utils::runMultiThreaded(size_t(0), _tasks.size(), [&](size_t _begin, size_t _end)
+		{
+			for (size_t i = _begin; i < _end; ++i)
+			{
+				ChainTask& task = _tasks[i];
+				const PixelList& pixels = *task.pixels;
+				if (pixels.marks.empty() || _chainMaxTimeInSec == 0.f)
+					task.chain = makePixelChainGreedy(pixels, _refMap);
+				// valid lines do not need the exhaustive search
+				else if (std::optional<PixelChain> chain = makePixelChainOnLine(pixels, _refMap, pixels.marks.front().idx))
+					task.chain = std::move(*chain);
+				else
+				{
+					if (_timeBudgetInSec >= 0.f)
+						task.chain = makePixelChainFromStart(pixels, _refMap, pixels.marks.front().idx);
+					task.needsSearch = true;
+				}
+			}
+		}, _numThreads);
+
+	// the budget starts with the searches, the threads of this frame only run its own tasks
+	const auto startTime = high_resolution_clock::now();
+	const float maxTime = _chainMaxTimeInSec < 0.f ? std::numeric_limits<float>::max() : _chainMaxTimeInSec;
+	const float budget = _timeBudgetInSec < 0.f ? std::numeric_limits<float>::max() : _timeBudgetInSec;
+	std::vector<size_t> pending;
+	for (size_t i = 0; i < _tasks.size(); ++i)
+		if (_tasks[i].needsSearch)
+			pending.push_back(i);
+	// the largest zones first so that the threads finish together
+	std::stable_sort(pending.begin(), pending.end(), [&](size_t _a, size_t _b)
+		{
+			return _tasks[_a].pixels->size() > _tasks[_b].pixels->size();
+		});
+
+	while (!pending.empty())
+	{
+		std::atomic<size_t> numWaiting = pending.size();
+		utils::runMultiThreaded(size_t(0), pending.size(), [&](size_t _begin, size_t _end)
+			{
+				for (size_t i = _begin; i < _end; ++i)
+				{
+					ChainTask& task = _tasks[pending[i]];
+					// up to _numThreads searches run at the same time
+					const size_t waiting = numWaiting--;
+					const float share = (budget - secondsSince(startTime)) / waiting 
+						* std::min<size_t>(_numThreads, waiting);
+					const float timeLimit = std::min(share, maxTime - task.searchTimeInSec);
+					if (timeLimit <= 0.f)
+						continue;
+
+					if (!task.search)
+						task.search = std::make_unique<PixelChainSearch>(*task.pixels, _refMap, task.chain, _numThreads);
+					// only the time that the search itself ran is charged to the zone
+					task.needsSearch = !task.search->run(timeLimit);
+					task.searchTimeInSec = task.search->timeInSec();
+				}
+			}, _numThreads);
+
+		const float timeLeft = budget - secondsSince(startTime);
+		pending.erase(std::remove_if(pending.begin(), pending.end(), [&](size_t _idx)
+			{
+				const ChainTask& task = _tasks[_idx];
+				return !task.needsSearch || timeLeft < MIN_SEARCH_TIME_IN_SEC
+					|| maxTime - task.searchTimeInSec < MIN_SEARCH_TIME_IN_SEC;
+			}), pending.end());
+	}
+
+	for (ChainTask& task : _tasks)
+	{
+		if (task.search)
+		{
+			task.chain = task.search->result();
+			task.search.reset();
+		}
+		if (!task.needsSearch)
+			continue;
+		// the budget was used up before the chain got all of its time
+		task.hitDeadline = maxTime - task.searchTimeInSec >= MIN_SEARCH_TIME_IN_SEC;
+		task.hadTimeout = !task.hitDeadline;
+	}
+}
+
+// Reports a search that did not finish.
+static void reportUnfinished(const ChainTask& _task, sf::Color _color, const TransferMap& _refMap,
+	utils::Diagnostics::Input _input, utils::Diagnostics::Local& _diagnostics)
+{
+	using Kind = utils::Diagnostics::Kind;
+	const Vector2u position = _refMap.index(_task.pixels->front());
+	if (_task.hadTimeout)
+		_diagnostics.add(Kind::ChainTimeout, _input, opaque(_color), position);
+	else if (_task.hitDeadline)
+		_diagnostics.add(Kind::ChainDeadline, _input, opaque(_color), position);
+}
+
+// The zones except for the empty exterior, sorted by descending size so that the
+// largest chains are started first when they are built in parallel.
+static std::vector<ZoneIndex::ZoneId> largestZonesFirst(const ZoneIndex& _zones)
+{
+	std::vector<ZoneIndex::ZoneId> order;
+	for (ZoneIndex::ZoneId id = 0; id < _zones.numZones(); ++id)
+		if ((_zones.begin() + id)->first != 0)
+			order.push_back(id);
+	std::stable_sort(order.begin(), order.end(), [&](ZoneIndex::ZoneId _a, ZoneIndex::ZoneId _b)
+		{
+			return _zones.zone(_a).size() > _zones.zone(_b).size();
+		});
+	return order;
+}
+
+ReferenceChains::ReferenceChains(const ImageView& _referenceSprite, 
+	std::shared_ptr<const ZoneIndex> _zones,
+	float _chainMaxTimeInSec,
+	float _timeBudgetInSec,
+	unsigned _numThreads,
+	utils::Diagnostics& _diagnostics)
+	: m_zones(std::move(_zones))
+{
+	using utils::Diagnostics;
+	// only used to convert flat indices
+	const TransferMap refMap(_referenceSprite.getSize(), Vector2u(0, 0));
+
+	m_chains.resize(m_zones->numZones());
+	const std::vector<ZoneIndex::ZoneId> order = largestZonesFirst(*m_zones);
+	std::vector<ChainTask> tasks(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		tasks[i].pixels = &m_zones->zone(order[i]);
+	makeChains(tasks, refMap, _chainMaxTimeInSec, _timeBudgetInSec, _numThreads);
+
+	Diagnostics::Local issues(_diagnostics);
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const sf::Color zoneColor((m_zones->begin() + order[i])->first);
+		ChainTask& task = tasks[i];
+		reportUnfinished(task, zoneColor, refMap, Diagnostics::Input::Reference, issues);
+
+		Chain& chain = m_chains[order[i]];
+		chain.pixels = std::move(task.chain);
+		chain.hadTimeout = task.hadTimeout;
+		chain.hitDeadline = task.hitDeadline;
+		chain.isMarked = ensureOrientation(chain.pixels, _referenceSprite, issues, Diagnostics::Input::Reference);
+	}
+}
+
+// ************************************************************* //
+TransferMap constructMap(const ImageView& _referenceSprite, 
+	const ImageView& _targetSprite,
+	const ReferenceChains& _srcChains,
+	const ZoneIndex& _dstZones,
 	OrientationHeuristic _orientationHeuristic,
 	ErrorImageWrapper& _errorRefImage,
 	ErrorImageWrapper& _errorTargetImage,
-	float _chainMaxTimeInSec)
+	float _chainMaxTimeInSec,
+	float _timeBudgetInSec,
+	unsigned _numThreads,
+	utils::Diagnostics& _diagnostics)
 {
-	if (_chainMaxTimeInSec < 0.f)
-		_chainMaxTimeInSec = std::numeric_limits<float>::max();
-		
+	using utils::Diagnostics;
 	const sf::Vector2u size = _referenceSprite.getSize();
 	// init empty map
 	TransferMap transferMap(size, Vector2u(0, 0));
 
-	// iterate over zonemaps of src and dst simultaneously
-	for (const auto& [zoneColor, dstPixels] : _dstZoneMap)
+	// the target zones that exist in the reference share the time budget
+	const std::vector<ZoneIndex::ZoneId> order = largestZonesFirst(_dstZones);
+	constexpr size_t NO_CHAIN = std::numeric_limits<size_t>::max();
+	std::vector<size_t> chainOfZone(_dstZones.numZones(), NO_CHAIN);
+	std::vector<ChainTask> dstChains;
+	for (ZoneIndex::ZoneId id : order)
 	{
-		// ignore the empty exterior
-		if (zoneColor == 0) 
+		if (_srcChains.zones().findZone((_dstZones.begin() + id)->first) == ZoneIndex::NO_ZONE)
 			continue;
+		chainOfZone[id] = dstChains.size();
+		dstChains.emplace_back().pixels = &_dstZones.zone(id);
+	}
+	makeChains(dstChains, transferMap, _chainMaxTimeInSec, _timeBudgetInSec, _numThreads);
 
+	// map the target zone _id to the reference chain of the same color
+	auto mapZone = [&](ZoneIndex::ZoneId _id, Diagnostics::Local& _issues,
+		DeferredErrorImage& _errorRefImage, DeferredErrorImage& _errorTargetImage)
+	{
+		const auto& [zoneColor, dstPixels] = *(_dstZones.begin() + _id);
 		const sf::Color col(zoneColor);
 
-		const auto& srcPixels = _srcZoneMap(zoneColor);
-		if (srcPixels.empty())
+		const ZoneIndex::ZoneId srcId = _srcChains.zones().findZone(zoneColor);
+		if (srcId == ZoneIndex::NO_ZONE)
 		{
-			std::cout << "[Warning] Zone map is invalid. The zone color (" << col
-				<< ") (alpha channel is ignored) was not found in the reference zone map. Skipping the current zone.\n";
+			// the zone is skipped
+			for (size_t p : dstPixels)
+				_issues.add(Diagnostics::Kind::MissingZone, Diagnostics::Input::Target, opaque(col), transferMap.index(p));
 			_errorTargetImage.draw(dstPixels, col);
-			continue;
+			return;
 		}
-
-		bool timeout = false;
-		PixelChain srcChain = srcPixels.marks.empty() || _chainMaxTimeInSec == 0.f
-			? makePixelChainGreedy(srcPixels, transferMap) 
-			: makePixelChain(srcPixels, transferMap, _chainMaxTimeInSec, timeout);
-		if (timeout)
-		{
-			timeout = false;
+		const PixelList& srcPixels = _srcChains.zones().zone(srcId);
+		const ReferenceChains::Chain& srcChainInfo = _srcChains.chain(srcId);
+		const PixelChain& srcChain = srcChainInfo.pixels;
+		// the issue is only reported once when the chain is built
+		if (srcChainInfo.hadTimeout || srcChainInfo.hitDeadline)
 			_errorRefImage.draw(srcPixels, col, false);
-			std::cout << "[Warning] Timeout during reference chain construction. Results might not be deterministic. The chain is probably too wide.\n";
-		}
-		PixelChain dstChain = dstPixels.marks.empty() || _chainMaxTimeInSec == 0.f
-			? makePixelChainGreedy(dstPixels, transferMap) 
-			: makePixelChain(dstPixels, transferMap, _chainMaxTimeInSec, timeout);
-		if (timeout)
+
+		ChainTask& dstTask = dstChains[chainOfZone[_id]];
+		PixelChain& dstChain = dstTask.chain;
+		if (dstTask.hadTimeout || dstTask.hitDeadline)
 		{
 			_errorTargetImage.draw(dstPixels, col, false);
-			std::cout << "[Warning] Timeout during target chain construction. Results might not be deterministic. The chain is probably too wide.\n";
+			reportUnfinished(dstTask, col, transferMap, Diagnostics::Input::Target, _issues);
 		}
 
-		const bool srcIsMarked = ensureOrientation(srcChain, _referenceSprite);
-		const bool dstIsMarked = ensureOrientation(dstChain, _targetSprite);
+		const bool srcIsMarked = srcChainInfo.isMarked;
+		const bool dstIsMarked = ensureOrientation(dstChain, _targetSprite, _issues, Diagnostics::Input::Target);
 
 		// ensureOrientation can also return false if no markers found which
 		// is currently not treated as an error. Therefore also check if there
@@ -312,8 +964,8 @@ TransferMap constructMap(const sf::Image& _referenceSprite,
 		{
 			if (!srcIsMarked && dstIsMarked)
 			{
-				std::cout << "[Warning] Found a chain start marker in the target but not in the source zone with color (" << col 
-					<< ") (alpha channel is ignored).\n";
+				_issues.add(Diagnostics::Kind::UnmatchedChainStart, Diagnostics::Input::Target, opaque(col),
+					dstChain.front());
 				_errorRefImage.draw(srcPixels, col, true);
 				_errorTargetImage.draw(dstPixels, col, true);
 			}
@@ -374,6 +1026,22 @@ TransferMap constructMap(const sf::Image& _referenceSprite,
 			const size_t endDiff = std::distance(srcIt, srcChain.end());
 			srcIt += std::min(advanceSteps, endDiff);
 		}
+	};
+
+	// Zones only write their own targets. The issue images are drawn afterwards
+	// in the order of the zones, which gives the same result as a sequential run.
+	std::vector<DeferredErrorImage> errorRefDraws(_dstZones.numZones());
+	std::vector<DeferredErrorImage> errorTargetDraws(_dstZones.numZones());
+	utils::runMultiThreaded(size_t(0), order.size(), [&](size_t _begin, size_t _end)
+		{
+			Diagnostics::Local issues(_diagnostics);
+			for (size_t i = _begin; i < _end; ++i)
+				mapZone(order[i], issues, errorRefDraws[order[i]], errorTargetDraws[order[i]]);
+		}, _numThreads);
+	for (ZoneIndex::ZoneId id = 0; id < _dstZones.numZones(); ++id)
+	{
+		errorRefDraws[id].apply(_errorRefImage);
+		errorTargetDraws[id].apply(_errorTargetImage);
 	}
 
 	return transferMap;
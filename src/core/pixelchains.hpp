@@ -7,6 +7,7 @@
 #include <deque>
 #include <vector>
 #include <array>
+#include <memory>
 
 enum struct OrientationHeuristic 
 {
@@ -21,11 +22,55 @@ const std::array<std::string, static_cast<size_t>(OrientationHeuristic::COUNT)>
 	{"direction"},
 } };
 
-TransferMap constructMap(const sf::Image& _referenceSprite, 
-	const sf::Image& _targetSprite,
-	const ZoneMap& _srcZoneMap,
-	const ZoneMap& _dstZoneMap,
+using PixelChain = std::vector<sf::Vector2u>;
+
+// The chains of all zones of the reference sprite. They do not depend on the target,
+// so they are built once and shared read-only by all frames.
+class ReferenceChains
+{
+public:
+	// @param _zones Index of _referenceSprite with alpha marks.
+	// @param _chainMaxTimeInSec Time limit for each chain. 0 uses the greedy construction
+	//		and a negative value means no limit.
+	// @param _timeBudgetInSec Time limit for the searches of all chains together. 
+	//		Chains that are not finished in time keep the best chain found so far.
+	//		A negative value means no limit.
+	// @param _numThreads Threads that build the chains.
+	// @param _diagnostics Receives the issues of the reference chains.
+	ReferenceChains(const ImageView& _referenceSprite, 
+		std::shared_ptr<const ZoneIndex> _zones,
+		float _chainMaxTimeInSec,
+		float _timeBudgetInSec,
+		unsigned _numThreads,
+		utils::Diagnostics& _diagnostics);
+
+	struct Chain
+	{
+		PixelChain pixels;
+		bool isMarked = false; //< starts with the start marker
+		bool hadTimeout = false;
+		bool hitDeadline = false; //< the time budget was used up before the search finished
+	};
+
+	const Chain& chain(ZoneIndex::ZoneId _id) const { return m_chains[_id]; }
+	const ZoneIndex& zones() const { return *m_zones; }
+private:
+	std::shared_ptr<const ZoneIndex> m_zones;
+	std::vector<Chain> m_chains; //< indexed by zone id, empty for the exterior
+};
+
+// @param _dstZones Index of _targetSprite with alpha marks.
+// @param _timeBudgetInSec Time limit for the searches of all target chains, see ReferenceChains.
+// @param _diagnostics Receives the issues of the target. Issues of the reference
+//		chains are only reported when they are built.
+TransferMap constructMap(const ImageView& _referenceSprite, 
+	const ImageView& _targetSprite,
+	const ReferenceChains& _srcChains,
+	const ZoneIndex& _dstZones,
 	OrientationHeuristic _orientationHeuristic,
 	ErrorImageWrapper& _errorRefImage,
 	ErrorImageWrapper& _errorTargetImage,
-	float _chainMaxTimeInSec);
\ No newline at end of file
+	float _chainMaxTimeInSec,
+	float _timeBudgetInSec,
+	unsigned _numThreads,
+	utils::Diagnostics& _diagnostics);
\ No newline at end of file
@@ -7,7 +7,48 @@
 
 using namespace math;
 
-DistanceBase::DistanceBase(const sf::Image& _src, const sf::Image& _dst)
+// Blur with the normalized _kernel.
+static Matrix<sf::Vector3f> blurImage(const ImageView& _image, const Matrix<float>& _kernel)
+{
+	const float kernelSum = std::accumulate(_kernel.begin(), _kernel.end(), 0.f);
+
+	auto sample = [](const float f, const sf::Color& color)
+	{
+		return f * toVec(color);
+	};
+
+	auto sum = [kernelSum](const Matrix<sf::Vector3f>& result)
+	{
+		return std::accumulate(result.begin(), result.end(), sf::Vector3f{})
+			/ kernelSum;
+	};
+
+	return math::applyConvolution(_image, _kernel, sample, sum);
+}
+
+// ************************************************************* //
+std::shared_ptr<const PaddedImage<>> SourcePlanes::padded(const sf::Vector2u& _border) const
+{
+	std::scoped_lock lock(m_mutex);
+	for (const auto& [border, padded] : m_padded)
+		if (border == _border)
+			return padded;
+
+	return m_padded.emplace_back(_border, std::make_shared<const PaddedImage<>>(makePaddedImage(m_src, _border))).second;
+}
+
+std::shared_ptr<const Matrix<sf::Vector3f>> SourcePlanes::blurred(const Matrix<float>& _kernel) const
+{
+	std::scoped_lock lock(m_mutex);
+	for (const auto& [kernel, blurred] : m_blurred)
+		if (kernel == _kernel)
+			return blurred;
+
+	return m_blurred.emplace_back(_kernel, std::make_shared<const Matrix<sf::Vector3f>>(blurImage(m_src, _kernel))).second;
+}
+
+// ************************************************************* //
+DistanceBase::DistanceBase(const ImageView& _src, const ImageView& _dst)
 	: m_src(_src),
 	m_dst(_dst)
 {
@@ -15,8 +56,8 @@ DistanceBase::DistanceBase(const sf::Image& _src, const sf::Image& _dst)
 }
 
 // ************************************************************* //
-IdentityDistance::IdentityDistance(const sf::Image& _src,
-	const sf::Image& _dst,
+IdentityDistance::IdentityDistance(const ImageView& _src,
+	const ImageView& _dst,
 	const math::Matrix<float>&)
 	: DistanceBase(_src, _dst)
 {
@@ -26,29 +67,37 @@ Matrix<float> IdentityDistance::operator()(unsigned x, unsigned y) const
 {
 	const sf::Vector2u size = getSize();
 	Matrix<float> distances(size);
-	const sf::Color dstColor = m_dst.getPixel(x, y);
+	const PackedColor dstColor = m_dst(x, y);
 
 	for (unsigned iy = 0; iy < size.y; ++iy)
 		for (unsigned ix = 0; ix < size.x; ++ix)
-			distances(ix, iy) = dstColor == m_src.getPixel(ix, iy) ? 0.f : 1.f;
+			distances(ix, iy) = dstColor == m_src(ix, iy) ? 0.f : 1.f;
 
 	return distances;
 }
 
 // ************************************************************* //
-KernelDistance::KernelDistance(const sf::Image& _src,
-	const sf::Image& _dst,
+KernelDistance::KernelDistance(const ImageView& _src,
+	const ImageView& _dst,
 	const sf::Vector2u& _kernelSize,
 	float _rotation)
 	: KernelDistance(_src,_dst, Matrix<float>(_kernelSize,1.f), _rotation)
 {}
 
-KernelDistance::KernelDistance(const sf::Image& _src,
-	const sf::Image& _dst,
+KernelDistance::KernelDistance(const ImageView& _src,
+	const ImageView& _dst,
 	const math::Matrix<float>& _kernel,
 	float _rotation)
-	: DistanceBase(_src, _dst),
+	: KernelDistance(SourcePlanes(_src), _dst, _kernel, _rotation)
+{}
+
+KernelDistance::KernelDistance(const SourcePlanes& _src,
+	const ImageView& _dst,
+	const math::Matrix<float>& _kernel,
+	float _rotation)
+	: DistanceBase(_src.image(), _dst),
 	m_kernelHalSize(_kernel.size.x / 2, _kernel.size.y / 2),
+	m_srcPadded(_src.padded(m_kernelHalSize)),
 	m_kernelWeights(_kernel),
 	m_sampleCoords(_kernel.size),
 	m_kernelSum(std::accumulate(m_kernelWeights.begin(), m_kernelWeights.end(), 0.f))
@@ -81,7 +130,7 @@ Matrix<float> KernelDistance::operator()(unsigned x, unsigned y) const
 			/ m_kernelSum;
 	};
 
-	return applyConvolution(m_src, makeKernel(x, y), distance, sum);
+	return applyConvolution(*m_srcPadded, getSize(), makeKernel(x, y), distance, sum);
 }
 
 KernelDistance::Kernel KernelDistance::makeKernel(unsigned x, unsigned y) const
@@ -100,34 +149,27 @@ KernelDistance::Kernel KernelDistance::makeKernel(unsigned x, unsigned y) const
 };
 
 // ************************************************************* //
-BlurDistance::BlurDistance(const sf::Image& _src,
-	const sf::Image& _dst,
+BlurDistance::BlurDistance(const ImageView& _src,
+	const ImageView& _dst,
 	const sf::Vector2u& _kernelSize)
 	: BlurDistance(_src, _dst, Matrix<float>(_kernelSize,1.f))
 {
 }
 
-BlurDistance::BlurDistance(const sf::Image& _src,
-	const sf::Image& _dst,
+BlurDistance::BlurDistance(const ImageView& _src,
+	const ImageView& _dst,
 	const math::Matrix<float>& _kernel)
-	: DistanceBase(_src, _dst)
+	: BlurDistance(SourcePlanes(_src), _dst, _kernel)
 {
-	const sf::Vector2u kernelHalf(_kernel.size.x / 2, _kernel.size.y / 2);
-	const float kernelSum = std::accumulate(_kernel.begin(), _kernel.end(), 0.f);
-
-	auto sample = [](const float f, const sf::Color& color)
-	{
-		return f * toVec(color);
-	};
-
-	auto sum = [kernelSum](const Matrix<sf::Vector3f>& result)
-	{
-		return std::accumulate(result.begin(), result.end(), sf::Vector3f{})
-			/ kernelSum;
-	};
+}
 
-	m_dstBlurred = math::applyConvolution(_dst, _kernel, sample, sum);
-	m_srcBlurred = math::applyConvolution(_src, _kernel, sample, sum);
+BlurDistance::BlurDistance(const SourcePlanes& _src,
+	const ImageView& _dst,
+	const math::Matrix<float>& _kernel)
+	: DistanceBase(_src.image(), _dst),
+	m_dstBlurred(blurImage(_dst, _kernel)),
+	m_srcBlurred(_src.blurred(_kernel))
+{
 }
 
 Matrix<float> BlurDistance::operator()(unsigned x, unsigned y) const
@@ -136,9 +178,9 @@ Matrix<float> BlurDistance::operator()(unsigned x, unsigned y) const
 
 	const sf::Vector3f color = m_dstBlurred(x, y);
 
-	for (size_t i = 0; i < m_srcBlurred.elements.size(); ++i)
+	for (size_t i = 0; i < m_srcBlurred->elements.size(); ++i)
 	{
-		distances[i] = math::distSq(m_srcBlurred[i], color);
+		distances[i] = math::distSq((*m_srcBlurred)[i], color);
 	}
 	return distances;
 }
@@ -146,8 +188,15 @@ Matrix<float> BlurDistance::operator()(unsigned x, unsigned y) const
 // ************************************************************* //
 
 constexpr float pi = 3.14159265f;
-RotInvariantKernelDistance::RotInvariantKernelDistance(const sf::Image& _src,
-	const sf::Image& _dst,
+RotInvariantKernelDistance::RotInvariantKernelDistance(const ImageView& _src,
+	const ImageView& _dst,
+	const math::Matrix<float>& _kernel)
+	: RotInvariantKernelDistance(SourcePlanes(_src), _dst, _kernel)
+{
+}
+
+RotInvariantKernelDistance::RotInvariantKernelDistance(const SourcePlanes& _src,
+	const ImageView& _dst,
 	const math::Matrix<float>& _kernel)
 	: GroupMinDistance({ 
 		KernelDistance(_src, _dst, _kernel, pi * 0.f),
@@ -2,17 +2,74 @@
 
 #include <SFML/Graphics.hpp>
 #include "../math/matrix.hpp"
+#include "../math/convolution.hpp"
 #include "../utils/utils.hpp"
+#include "../utils/imageview.hpp"
+#include "../math/vectorext.hpp"
+
+#include <limits>
+#include <array>
+#include <tuple>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+/* Besides the dense operator()(x,y) each distance measure provides
+ *		auto forTarget(unsigned x, unsigned y) const
+ * which returns a functor float(const sf::Vector2u& _src, float _bound) for the
+ * distance of a single source pixel to the target pixel (x,y). It computes the 
+ * same values as the dense version but allows constructMap to only evaluate
+ * the candidates it needs. If the result would be larger than _bound, any value 
+ * larger than _bound may be returned instead.
+ *
+ * Analytic distances (IS_ANALYTIC) are closed-form functions of the offset to a
+ * prior position. They additionally provide
+ *		sf::Vector2u prior(unsigned x, unsigned y) const;
+ *		float lowerBound(unsigned _radius) const;
+ * where the bound holds for all source pixels with a Chebyshev distance of 
+ * at least _radius to the prior. 
+ */
+namespace details {
+	template<typename Distance, typename = void>
+	struct IsAnalytic : std::false_type {};
+	template<typename Distance>
+	struct IsAnalytic<Distance, std::enable_if_t<Distance::IS_ANALYTIC>> : std::true_type {};
+}
+
+template<typename Distance>
+constexpr bool isAnalyticDistance = details::IsAnalytic<Distance>::value;
+
+constexpr float NO_DISTANCE_BOUND = std::numeric_limits<float>::max();
+
+// Preprocessed versions of a source image that are shared by all distance measures
+// with this source, e.g. over all frames of an animation or all jobs of a batch.
+// Each version is computed on first use. The image has to outlive this object.
+class SourcePlanes
+{
+public:
+	explicit SourcePlanes(const ImageView& _src) : m_src(_src) {}
+
+	const ImageView& image() const { return m_src; }
+	// The source with a border of _border pixels on each side, see math::makePaddedImage.
+	std::shared_ptr<const math::PaddedImage<>> padded(const sf::Vector2u& _border) const;
+	// The source convolved with the normalized _kernel.
+	std::shared_ptr<const math::Matrix<sf::Vector3f>> blurred(const math::Matrix<float>& _kernel) const;
+private:
+	ImageView m_src;
+	mutable std::mutex m_mutex;
+	mutable std::vector<std::pair<sf::Vector2u, std::shared_ptr<const math::PaddedImage<>>>> m_padded;
+	mutable std::vector<std::pair<math::Matrix<float>, std::shared_ptr<const math::Matrix<sf::Vector3f>>>> m_blurred;
+};
 
 class DistanceBase
 {
 public:
-	DistanceBase(const sf::Image& _src, const sf::Image& _dst);
+	DistanceBase(const ImageView& _src, const ImageView& _dst);
 
 	sf::Vector2u getSize() const { return m_src.getSize(); }
 protected:
-	const sf::Image& m_src;
-	const sf::Image& m_dst;
+	ImageView m_src;
+	ImageView m_dst;
 };
 
 // 0 if pixels have equal color; 1 if not
@@ -20,11 +77,19 @@ class IdentityDistance : public DistanceBase
 {
 public:
 	// the last argument is just a dummy
-	IdentityDistance(const sf::Image& _src,
-		const sf::Image& _dst,
+	IdentityDistance(const ImageView& _src,
+		const ImageView& _dst,
 		const math::Matrix<float>& = {});
 
 	math::Matrix<float> operator()(unsigned x, unsigned y) const;
+
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [src = m_src, color = m_dst(x, y)](const sf::Vector2u& _src, float = NO_DISTANCE_BOUND)
+		{
+			return color == src(_src.x, _src.y) ? 0.f : 1.f;
+		};
+	}
 };
 
 class KernelDistance : public DistanceBase
@@ -33,24 +98,47 @@ public:
 	// Create a kernel distance measure with constant weights.
 	// @param _rotation - rotation in radians by which the kernel is 
 	//					rotated and then discretized again
-	KernelDistance(const sf::Image& _src,
-		const sf::Image& _dst,
+	KernelDistance(const ImageView& _src,
+		const ImageView& _dst,
 		const sf::Vector2u& _kernelSize = sf::Vector2u(3, 3),
 		float _rotation = 0.f);
 
-	KernelDistance(const sf::Image& _src,
-		const sf::Image& _dst,
+	KernelDistance(const ImageView& _src,
+		const ImageView& _dst,
+		const math::Matrix<float>& _kernel,
+		float _rotation = 0.f);
+
+	KernelDistance(const SourcePlanes& _src,
+		const ImageView& _dst,
 		const math::Matrix<float>& _kernel,
 		float _rotation = 0.f);
 
 	math::Matrix<float> operator()(unsigned x, unsigned y) const;
 
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [this, &srcPadded = *m_srcPadded, kernel = makeKernel(x, y)](const sf::Vector2u& _src, float = NO_DISTANCE_BOUND)
+		{
+			// same order of summation as in the dense version
+			float sum = 0.f;
+			for (unsigned j = 0; j < kernel.size.y; ++j)
+				for (unsigned i = 0; i < kernel.size.x; ++i)
+				{
+					const auto& [weight, color] = kernel(i, j);
+					sum += color == srcPadded(_src.x + i, _src.y + j) ? 0.f : weight;
+				}
+			return sum / m_kernelSum;
+		};
+	}
+
 	const math::Matrix<sf::Vector2i>& sampleCoords() const { return m_sampleCoords; }
 private:
 	using Kernel = math::Matrix<std::pair<float, sf::Color>>;
 	Kernel makeKernel(unsigned x, unsigned y) const;
 
 	sf::Vector2u m_kernelHalSize;
+	// source padded once for all target pixels; tiled so that kernel windows are cache-local
+	std::shared_ptr<const math::PaddedImage<>> m_srcPadded;
 	math::Matrix<float> m_kernelWeights;
 	math::Matrix<sf::Vector2i> m_sampleCoords;
 	float m_kernelSum;
@@ -59,21 +147,44 @@ private:
 class BlurDistance : public DistanceBase
 {
 public:
-	BlurDistance(const sf::Image& _src,
-		const sf::Image& _dst,
+	BlurDistance(const ImageView& _src,
+		const ImageView& _dst,
 		const sf::Vector2u& _kernelSize = sf::Vector2u(3, 3));
 
-	BlurDistance(const sf::Image& _src,
-		const sf::Image& _dst,
+	BlurDistance(const ImageView& _src,
+		const ImageView& _dst,
+		const math::Matrix<float>& _kernel);
+
+	BlurDistance(const SourcePlanes& _src,
+		const ImageView& _dst,
 		const math::Matrix<float>& _kernel);
 
 	math::Matrix<float> operator()(unsigned x, unsigned y) const;
+
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [&srcBlurred = *m_srcBlurred, color = m_dstBlurred(x, y)](const sf::Vector2u& _src, float = NO_DISTANCE_BOUND)
+		{
+			return math::distSq(srcBlurred(_src), color);
+		};
+	}
 private:
 	math::Matrix<sf::Vector3f> m_dstBlurred;
-	math::Matrix<sf::Vector3f> m_srcBlurred;
+	std::shared_ptr<const math::Matrix<sf::Vector3f>> m_srcBlurred;
 	sf::Vector2u m_kernelHalSize;
 };
 
+// forTarget for each element of a group
+template<typename DistanceMeasure>
+auto makeTargetDistances(const std::vector<DistanceMeasure>& _distances, unsigned x, unsigned y)
+{
+	std::vector<decltype(_distances.front().forTarget(x, y))> targetDistances;
+	targetDistances.reserve(_distances.size());
+	for (const DistanceMeasure& distance : _distances)
+		targetDistances.push_back(distance.forTarget(x, y));
+	return targetDistances;
+}
+
 template<typename BaseDistance>
 class ScaleDistance
 {
@@ -88,6 +199,24 @@ public:
 		return dist;
 	}
 
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [distance = m_distance.forTarget(x, y), scale = m_scale](const sf::Vector2u& _src, 
+			float = NO_DISTANCE_BOUND)
+		{
+			return distance(_src) * scale;
+		};
+	}
+
+	// scaling preserves the closed form
+	static constexpr bool IS_ANALYTIC = isAnalyticDistance<BaseDistance>;
+
+	template<bool Analytic = IS_ANALYTIC, typename = std::enable_if_t<Analytic>>
+	sf::Vector2u prior(unsigned x, unsigned y) const { return m_distance.prior(x, y); }
+
+	template<bool Analytic = IS_ANALYTIC, typename = std::enable_if_t<Analytic>>
+	float lowerBound(unsigned _radius) const { return m_distance.lowerBound(_radius) * m_scale; }
+
 	sf::Vector2u getSize() const { return m_distance.getSize(); }
 private:
 	BaseDistance m_distance;
@@ -108,6 +237,28 @@ public:
 		return evaluate(x, y, std::make_index_sequence<sizeof...(DistanceMeasures)>{});
 	}
 
+	// Analytic terms are evaluated first. If they already exceed the bound,
+	// the remaining terms are skipped since all distances are non-negative.
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return forTarget(x, y, std::make_index_sequence<sizeof...(DistanceMeasures)>{});
+	}
+
+	// the analytic terms provide the prior; the other terms can only increase the distance
+	static constexpr bool HAS_ANALYTIC_TERM = (isAnalyticDistance<DistanceMeasures> || ...);
+
+	template<bool Analytic = HAS_ANALYTIC_TERM, typename = std::enable_if_t<Analytic>>
+	sf::Vector2u prior(unsigned x, unsigned y) const 
+	{ 
+		return std::get<firstAnalyticTerm()>(m_distances).prior(x, y); 
+	}
+
+	template<bool Analytic = HAS_ANALYTIC_TERM, typename = std::enable_if_t<Analytic>>
+	float lowerBound(unsigned _radius) const 
+	{ 
+		return std::get<firstAnalyticTerm()>(m_distances).lowerBound(_radius);
+	}
+
 	sf::Vector2u getSize() const { return std::get<0>(m_distances).getSize(); }
 private:
 	template<std::size_t... I>
@@ -116,6 +267,39 @@ private:
 		return (... + std::get<I>(m_distances)(x, y));
 	}
 
+	template<std::size_t... I>
+	auto forTarget(unsigned x, unsigned y, std::index_sequence<I...>) const
+	{
+		return [distances = std::make_tuple(std::get<I>(m_distances).forTarget(x, y)...)]
+			(const sf::Vector2u& _src, float _bound = NO_DISTANCE_BOUND)
+		{
+			std::array<float, sizeof...(I)> values{};
+			float analyticSum = 0.f;
+			((IS_ANALYTIC_TERM<I> ? (values[I] = std::get<I>(distances)(_src), analyticSum += values[I]) : 0.f), ...);
+			if (analyticSum > _bound)
+				return analyticSum;
+
+			((IS_ANALYTIC_TERM<I> ? 0.f : (values[I] = std::get<I>(distances)(_src))), ...);
+			// same order of summation as in the dense version
+			float sum = values[0];
+			for (size_t i = 1; i < values.size(); ++i)
+				sum += values[i];
+			return sum;
+		};
+	}
+
+	template<size_t I>
+	static constexpr bool IS_ANALYTIC_TERM = isAnalyticDistance<std::tuple_element_t<I, std::tuple<DistanceMeasures...>>>;
+
+	static constexpr size_t firstAnalyticTerm()
+	{
+		constexpr std::array<bool, sizeof...(DistanceMeasures)> isAnalytic = { isAnalyticDistance<DistanceMeasures>... };
+		for (size_t i = 0; i < isAnalytic.size(); ++i)
+			if (isAnalytic[i])
+				return i;
+		return 0;
+	}
+
 	std::tuple<DistanceMeasures...> m_distances;
 };
 
@@ -139,6 +323,21 @@ public:
 		return distance;
 	}
 
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [distances = makeTargetDistances(m_distances, x, y)](const sf::Vector2u& _src, 
+			float = NO_DISTANCE_BOUND)
+		{
+			float distance = distances[0](_src);
+			for (size_t i = 1; i < distances.size(); ++i)
+				distance += distances[i](_src);
+
+			distance *= 1.f / distances.size();
+
+			return distance;
+		};
+	}
+
 	sf::Vector2u getSize() const { return m_distances.front().getSize(); }
 private:
 	std::vector<DistanceMeasure> m_distances;
@@ -185,8 +384,50 @@ public:
 		return distSum;
 	}
 
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return TargetDistance<decltype(m_distances.front().forTarget(x, y))>{ 
+			makeTargetDistances(m_distances, x, y),
+			m_discardThreshold,
+			std::vector<float>(m_distances.size()) };
+	}
+
 	sf::Vector2u getSize() const { return m_distances.front().getSize(); }
 private:
+	template<typename Distance>
+	struct TargetDistance
+	{
+		std::vector<Distance> distances;
+		float discardThreshold;
+		mutable std::vector<float> dists; //< reused buffer
+
+		float operator()(const sf::Vector2u& _src, float = NO_DISTANCE_BOUND) const
+		{
+			// same operations as the dense version
+			dists[0] = distances[0](_src);
+			float distSum = dists[0];
+			for (size_t i = 1; i < distances.size(); ++i)
+			{
+				dists[i] = distances[i](_src);
+				distSum += dists[i];
+			}
+
+			size_t numMeasures = distances.size();
+			const float threshold = distSum / numMeasures + discardThreshold;
+			for (float d : dists)
+			{
+				if (d > threshold)
+				{
+					distSum -= d;
+					--numMeasures;
+				}
+			}
+			distSum *= 1.f / numMeasures;
+
+			return distSum;
+		}
+	};
+
 	float m_discardThreshold;
 	std::vector<DistanceMeasure> m_distances;
 };
@@ -208,6 +449,19 @@ public:
 		return distance;
 	}
 
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [distances = makeTargetDistances(m_distances, x, y)](const sf::Vector2u& _src, 
+			float = NO_DISTANCE_BOUND)
+		{
+			float distance = distances[0](_src);
+			for (size_t i = 1; i < distances.size(); ++i)
+				distance = std::min(distance, distances[i](_src));
+
+			return distance;
+		};
+	}
+
 	sf::Vector2u getSize() const { return m_distances.front().getSize(); }
 private:
 	std::vector<DistanceMeasure> m_distances;
@@ -216,8 +470,12 @@ private:
 class RotInvariantKernelDistance : public GroupMinDistance<KernelDistance>
 {
 public:
-	RotInvariantKernelDistance(const sf::Image& _src,
-		const sf::Image& _dst,
+	RotInvariantKernelDistance(const ImageView& _src,
+		const ImageView& _dst,
+		const math::Matrix<float>& _kernel);
+	// all rotations share the padded source
+	RotInvariantKernelDistance(const SourcePlanes& _src,
+		const ImageView& _dst,
 		const math::Matrix<float>& _kernel);
 private:
 };
@@ -250,6 +508,15 @@ public:
 		return dist;
 	}
 
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [mask = m_mask.forTarget(x, y), distance = m_distance.forTarget(x, y), maxDistance = m_maxDistance]
+			(const sf::Vector2u& _src, float = NO_DISTANCE_BOUND)
+		{
+			return mask(_src) != 0.f ? maxDistance : distance(_src);
+		};
+	}
+
 	sf::Vector2u getSize() const { return m_distance.getSize(); }
 private:
 	DistMeasure1 m_mask;
@@ -267,7 +534,72 @@ public:
 
 	sf::Vector2u getSize() const { return m_map.size; }
 	math::Matrix<float> operator()(unsigned x, unsigned y) const;
+
+	auto forTarget(unsigned x, unsigned y) const
+	{
+		return [origin = m_map(x, y), scale = m_scaleFactor](const sf::Vector2u& _src, float = NO_DISTANCE_BOUND)
+		{
+			const sf::Vector2u dist = _src - origin;
+			return scale * std::sqrt(static_cast<float>(math::dot(dist, dist)));
+		};
+	}
+
+	// The distance only depends on the offset to the position in the map.
+	static constexpr bool IS_ANALYTIC = true;
+	sf::Vector2u prior(unsigned x, unsigned y) const { return m_map(x, y); }
+	float lowerBound(unsigned _radius) const { return m_scaleFactor * _radius; }
 private:
 	math::Matrix<sf::Vector2u> m_map;
 	float m_scaleFactor;
-};
\ No newline at end of file
+};
+// Distance measure with its type erased so that measures of different types 
+// can be searched together, see constructMaps. Only forTarget is available.
+// The type is erased per block of sources, so that the distance of the actual
+// measure is called directly for each source.
+class AnyDistance
+{
+public:
+	// The distance of one target to blocks of sources.
+	class TargetDistance
+	{
+	public:
+		virtual ~TargetDistance() = default;
+		// Computes the distances of _count sources into _distances.
+		// Each distance may stop early once it is larger than _bound.
+		virtual void operator()(const sf::Vector2u* _sources, size_t _count, float _bound, 
+			float* _distances) const = 0;
+	};
+
+	template<typename DistanceMeasure, 
+		typename = std::enable_if_t<!std::is_same_v<std::decay_t<DistanceMeasure>, AnyDistance>>>
+	explicit AnyDistance(DistanceMeasure&& _distance)
+		: m_size(_distance.getSize()),
+		m_forTarget([distance = std::make_shared<std::decay_t<DistanceMeasure>>(std::forward<DistanceMeasure>(_distance))]
+			(unsigned x, unsigned y) -> std::unique_ptr<TargetDistance>
+			{
+				return std::make_unique<TargetDistanceImpl<decltype(distance->forTarget(x, y))>>(distance->forTarget(x, y));
+			})
+	{}
+
+	sf::Vector2u getSize() const { return m_size; }
+	std::unique_ptr<TargetDistance> forTarget(unsigned x, unsigned y) const { return m_forTarget(x, y); }
+private:
+	template<typename Distance>
+	class TargetDistanceImpl : public TargetDistance
+	{
+	public:
+		explicit TargetDistanceImpl(Distance _distance) : m_distance(std::move(_distance)) {}
+
+		void operator()(const sf::Vector2u* _sources, size_t _count, float _bound, 
+			float* _distances) const override
+		{
+			for (size_t i = 0; i < _count; ++i)
+				_distances[i] = m_distance(_sources[i], _bound);
+		}
+	private:
+		Distance m_distance;
+	};
+
+	sf::Vector2u m_size;
+	std::function<std::unique_ptr<TargetDistance>(unsigned, unsigned)> m_forTarget;
+};
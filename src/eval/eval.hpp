@@ -1,10 +1,11 @@
 #pragma once
 
 #include <SFML/Graphics.hpp>
+#include "../math/convolution.hpp"
 
 namespace eval {
 
-	sf::Image imageDifference(const sf::Image& a, const sf::Image& b);
+	sf::Image imageDifference(const ImageView& a, const ImageView& b);
 
 	struct PixelNeighbourhood
 	{
@@ -12,23 +13,42 @@ namespace eval {
 
 		unsigned maxRadius;
 		
-		float operator()(unsigned _x, unsigned _y, const sf::Image& _a, const sf::Image& _b);
+		// @param Image Any image type with pixel access through (x,y).
+		template<typename Image>
+		float operator()(unsigned _x, unsigned _y, const Image& _a, const Image& _b) const
+		{
+			const sf::Vector2u size = _a.size;
+			const unsigned minY = _y > maxRadius ? _y - maxRadius : 0u;
+			const unsigned minX = _x > maxRadius ? _x - maxRadius : 0u;
+			const unsigned maxY = std::min(_y + maxRadius + 1, size.y);
+			const unsigned maxX = std::min(_x + maxRadius + 1, size.x);
+
+			const sf::Color color = _b(_x, _y);
+			for (unsigned y = minY; y < maxY; ++y)
+				for (unsigned x = minX; x < maxX; ++x)
+					if (color == _a(x, y))
+						return 0.f;
+			return 1.f;
+		}
 	};
 	// Computes a single value for the difference between _a and _b
 	// where 0 is equality.
 	template<typename Diff>
-	float relativeError(const sf::Image& _a, const sf::Image& _b, Diff _diff)
+	float relativeError(const ImageView& _a, const ImageView& _b, Diff _diff)
 	{
 		const sf::Vector2u size = _a.getSize();
+		// tiled copies so that neighbourhood checks are cache-local
+		const math::PaddedImage<> a = math::makePaddedImage(_a, sf::Vector2u(0, 0));
+		const math::PaddedImage<> b = math::makePaddedImage(_b, sf::Vector2u(0, 0));
 		float err = 0.f;
 
 		for (unsigned y = 0; y < size.y; ++y)
 		{
 			for (unsigned x = 0; x < size.x; ++x)
 			{
-				err += _diff(x, y, _a, _b);
+				err += _diff(x, y, a, b);
 			}
 		}
 		return err / (size.x * size.y);
 	}
-}
\ No newline at end of file
+}
@@ -3,6 +3,9 @@
 #include <thread>
 #include <filesystem>
 #include <array>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
 
 #include <args.hxx>
 #include "mapmaker.hpp"
@@ -104,6 +107,191 @@ std::pair< SimilarityType, Matrix<float>> parseSimilarityArg(const std::string&
 	return { type, kernel };
 }
 
+// Split a cascade of the form "cascade <margin> | <first measure> | <second measure>".
+// @return false if _arg does not describe a cascade.
+bool parseCascadeArg(const std::string& _arg, float& _margin, std::string& _first, std::string& _second)
+{
+	std::stringstream ss(_arg);
+	std::string typeStr;
+	ss >> typeStr;
+	if (typeStr != "cascade")
+		return false;
+
+	std::string separator;
+	ss >> _margin >> separator;
+	if (!ss || separator != "|")
+	{
+		std::cerr << "[Error] Could not parse the cascade \"" << _arg 
+			<< "\". Expected the form \"cascade <margin> | <measure> | <measure>\".\n";
+		std::abort();
+	}
+
+	std::getline(ss, _first, '|');
+	std::getline(ss, _second);
+	if (_first.empty() || _second.empty() || _second.find('|') != std::string::npos)
+	{
+		std::cerr << "[Error] A cascade needs exactly two similarity measures.\n";
+		std::abort();
+	}
+
+	return true;
+}
+
+// Whether the type can be used as a stage of a cascade.
+// Both stages need to search per target pixel with a distance measure.
+bool isCascadeStage(SimilarityType _type)
+{
+	return _type != SimilarityType::Chain
+#ifdef WITH_TORCH
+		&& _type != SimilarityType::MSEOptim
+#endif
+		;
+}
+
+template<typename Similarity, template<typename> class Group>
+std::function<AnyDistance(int)> makeDistanceFactory(const MapMaker& _maker, const Matrix<float>& _kernel)
+{
+	return [&_maker, _kernel](int _frame)
+	{
+		return AnyDistance(_maker.makeDistance<Similarity, Group>(_frame, _kernel));
+	};
+}
+
+// Factory for the type erased distance measure of a similarity search.
+// @return An empty function if the type does not search with a distance measure.
+std::function<AnyDistance(int)> makeDistanceFactory(const MapMaker& _maker, SimilarityType _type, const Matrix<float>& _kernel)
+{
+	switch (_type)
+	{
+	case SimilarityType::Identity: return makeDistanceFactory<IdentityDistance, GroupDistanceThreshold>(_maker, _kernel);
+	case SimilarityType::Equality: return makeDistanceFactory<KernelDistance, GroupDistanceThreshold>(_maker, _kernel);
+	case SimilarityType::Blur: return makeDistanceFactory<BlurDistance, GroupDistanceThreshold>(_maker, _kernel);
+	case SimilarityType::EqualityRotInv: return makeDistanceFactory<RotInvariantKernelDistance, GroupDistanceThreshold>(_maker, _kernel);
+	case SimilarityType::MinEquality: return makeDistanceFactory<KernelDistance, GroupMinDistance>(_maker, _kernel);
+	case SimilarityType::MinBlur: return makeDistanceFactory<BlurDistance, GroupMinDistance>(_maker, _kernel);
+	case SimilarityType::MinEqualityRotInv: return makeDistanceFactory<RotInvariantKernelDistance, GroupMinDistance>(_maker, _kernel);
+	default: return {};
+	}
+}
+
+// Name of the k-th map file if several maps are created at once, e.g. "name_k.map".
+std::string makeMapFileName(const std::string& _mapName, size_t _k)
+{
+	const std::filesystem::path path(_mapName);
+	std::filesystem::path fileName = path.parent_path() / path.stem();
+	fileName += "_" + std::to_string(_k) + path.extension().string();
+	return fileName.string();
+}
+
+// A map to create from a shared set of reference sprites.
+struct CreateJob
+{
+	std::vector<std::string> targetNames;
+	std::string mapName;
+	// an additional (input, target) pair that serves as zone map
+	std::optional<std::pair<std::string, std::string>> zoneMap = {};
+	std::string confidenceName = "confidence.png";
+	// put in front of the progress messages
+	std::string logPrefix = {};
+};
+
+// Read a job list where each line has the form "output | targets ... | zone_input zone_target".
+// The zone map is optional. Paths with spaces are put in quotes. Empty lines and lines 
+// starting with # are skipped.
+std::vector<CreateJob> readJobs(const std::string& _fileName)
+{
+	std::vector<CreateJob> jobs;
+	std::ifstream file(_fileName);
+	if (!file)
+	{
+		std::cerr << "[Error] Could not open the job list \"" << _fileName << "\".\n";
+		return jobs;
+	}
+
+	auto split = [](const std::string& _str)
+	{
+		std::vector<std::string> tokens;
+		std::stringstream stream(_str);
+		std::string token;
+		while (stream >> std::quoted(token))
+			tokens.push_back(token);
+		return tokens;
+	};
+
+	std::string line;
+	for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+	{
+		if (line.empty() || line.front() == '#')
+			continue;
+		std::vector<std::string> parts;
+		std::stringstream stream(line);
+		std::string part;
+		while (std::getline(stream, part, '|'))
+			parts.push_back(part);
+
+		const std::vector<std::string> output = parts.size() > 0 ? split(parts[0]) : std::vector<std::string>{};
+		const std::vector<std::string> zoneMap = parts.size() > 2 ? split(parts[2]) : std::vector<std::string>{};
+		if (parts.size() < 2 || parts.size() > 3 || output.size() != 1 || (parts.size() == 3 && zoneMap.size() != 2))
+		{
+			std::cout << "[Warning] Skipping line " << lineNumber << " of the job list as it is not of the form \"output | targets ... | zone_input zone_target\".\n";
+			continue;
+		}
+
+		CreateJob& job = jobs.emplace_back();
+		job.mapName = output.front();
+		job.targetNames = split(parts[1]);
+		if (zoneMap.size() == 2)
+			job.zoneMap = std::make_pair(zoneMap[0], zoneMap[1]);
+		job.confidenceName = job.mapName + ".confidence.png";
+		job.logPrefix = job.mapName + ": ";
+	}
+
+	return jobs;
+}
+
+// Read all remaining maps in _in.
+std::vector<TransferMap> readMaps(std::istream& _in)
+{
+	std::vector<TransferMap> maps;
+	while (_in)
+	{
+		maps.emplace_back();
+		_in >> maps.back();
+	}
+	// an empty map is read before encountering eof
+	if (maps.back().size.x == 0)
+		maps.pop_back();
+	return maps;
+}
+
+// Read all maps in the file _name. Issues a warning if there are none.
+std::vector<TransferMap> readMaps(const std::string& _name)
+{
+	if (!std::filesystem::exists(_name))
+	{
+		std::cout << "[Warning] Skipping the map "
+			<< _name << " as the file could not be found.\n";
+		return {};
+	}
+	std::ifstream file(_name);
+	std::vector<TransferMap> maps = readMaps(file);
+	if (maps.empty())
+		std::cout << "[Warning] The file " << _name << " does not contain a valid map.\n";
+	return maps;
+}
+
+// Parse a shard given as "i/n".
+std::optional<Shard> parseShardArg(const std::string& _arg)
+{
+	std::stringstream stream(_arg);
+	Shard shard;
+	char delim = 0;
+	if (!(stream >> shard.index >> delim >> shard.count) || delim != '/' 
+		|| shard.count == 0 || shard.index >= shard.count)
+		return std::nullopt;
+	return shard;
+}
+
 int main(int argc, char* argv[])
 {
 	args::ArgumentParser parser("Sprite animation generator.");
@@ -111,6 +299,8 @@ int main(int argc, char* argv[])
 	args::Group commands(parser, "commands");
 	args::Command applyMode(commands, "apply", "apply an existing map to a sprite");
 	args::Command diffMode(commands, "evaluate", "compute difference between two sprites");
+	args::Command mirrorMode(commands, "mirror", "mirror existing maps for the horizontally mirrored targets");
+	args::Command mergeMode(commands, "merge", "combine the partial maps of all shards of a (create) run");
 	
 	args::Group createArgs("creation exclusive arguments");
 	args::Command createMode(commands, "create", "create a map from reference sprites",
@@ -145,15 +335,45 @@ int main(int argc, char* argv[])
 		"for (create) use the first (input,target) pair as zone map instead of as regular input", 
 		{ 'z', "zones" });
 
-	args::ValueFlag<std::string> similarityMeasure(createArgs, "similarity_measure",
-		"a string describing the similarity measure to use for map creation; general form: \"type a x b m11 m21 ...; m21 m22 ...; ...\"",
-		{ 's', "similarity" }, defaultSimilarity);
+	args::ValueFlagList<std::string> similarityMeasures(createArgs, "similarity_measure",
+		"a string describing the similarity measure to use for map creation; general form: \"type a x b m11 m21 ...; m21 m22 ...; ...\"; with \"cascade margin | measure1 | measure2\" measure2 only recomputes pixels where the best match of measure1 is less than margin closer than the second best; if given multiple times, all measures are computed in a single pass and the maps are written to output_0, output_1, ...",
+		{ 's', "similarity" });
+	args::Flag mirrorSourcesFlag(arguments, "mirror_sources",
+		"for (mirror) and (create) with mirror_map also mirror the sources of the maps; use this if the mirrored animation has a mirrored reference sprite",
+		{ "mirror_sources" });
 	args::Flag debugFlag(arguments, "debug", 
 		"during (create) additional information is output; for (apply) the reference image is combined with a high contrast image to better visualize the map", 
 		{ "debug" });
 	args::ValueFlag<int> cropMinBorder(createArgs, "crop_border",
-		"accelerate (create) by cropping the empty frame around each sprite to at most crop_border pixels",
+		"crop the empty frame around each sprite to at most crop_border pixels during (create); transparent regions are skipped anyway unless full_search is set",
 		{ "crop" }, 0);
+	args::Flag fullSearchFlag(createArgs, "full_search",
+		"during (create) also search the pixels that are transparent in all inputs including their kernel support",
+		{ "full_search" });
+	args::Flag noReuseFlag(createArgs, "no_reuse",
+		"during (create) compute the map of every frame even if its targets equal an earlier frame",
+		{ "no_reuse" });
+	args::ValueFlag<std::string> mirrorMapName(createArgs, "mirror_map",
+		"during (create) start the search of each frame from the mirrored map of the same frame in mirror_map, e.g. the map of the other facing; only targets where the mirrored mapping has a distance larger than mirror_threshold are searched further",
+		{ "mirror" });
+	args::ValueFlag<float> mirrorThreshold(createArgs, "mirror_threshold",
+		"the largest distance of the mirrored mapping that is accepted during (create) with mirror_map",
+		{ "mirror_threshold" }, 0.f);
+	args::ValueFlag<float> temporalThreshold(createArgs, "temporal_threshold",
+		"during (create) start the search of each frame around the map of the previous frame; targets where the best of these candidates has a distance of at most temporal_threshold are not searched further",
+		{ "temporal" });
+	args::Flag resumeFlag(createArgs, "resume",
+		"during (create) skip the frames whose checkpoint in output.checkpoints was created with the same inputs; checkpoints are written by every run",
+		{ "resume" });
+	args::Flag keepCheckpointsFlag(createArgs, "keep_checkpoints",
+		"during (create) keep output.checkpoints after all maps are written, e.g. to resume after changing single frames",
+		{ "keep_checkpoints" });
+	args::ValueFlag<std::string> shardArg(createArgs, "shard",
+		"during (create) only compute the rows of shard i out of n, given as \"i/n\"; the partial maps of all shards are combined with (merge)",
+		{ "shard" });
+	args::ValueFlag<std::string> jobsFileName(createArgs, "jobs",
+		"for (create) run all jobs in the given file with the same inputs; each line has the form \"output | targets ... | zone_input zone_target\" where the zone map is optional and the targets replace -t and -o",
+		{ "jobs" });
 	args::ValueFlag<float> discardTreshold(createArgs, "discard_threshold",
 		"discards distance values during (create) with multiple sprites if they are larger than mean + threshold; distance values are in the range [0,1]",
 		{ "threshold" }, 1.f);
@@ -161,6 +381,9 @@ int main(int argc, char* argv[])
 	args::ValueFlag<float> chainMaxTimeInSec(createArgs, "chain_search_time",
 		"maximum time in [s] to search for optimal chain during (create); special values: \"0\" - no search, use greedy algorithm instead; <0 - no time limit",
 		{ "chain_search_time" }, 1.f);
+	args::ValueFlag<float> chainTimeBudgetInSec(createArgs, "chain_time_budget",
+		"maximum time in [s] for all chain searches of a frame during (create); time that is not needed by a chain is given to the others; <0 - no limit",
+		{ "chain_time_budget" }, -1.f);
 
 	args::GlobalOptions globals(parser, arguments);
 
@@ -184,6 +407,7 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 	const unsigned numThreads = args::get(threads);
+	utils::ThreadPool::setNumThreads(numThreads);
 
 	auto start = std::chrono::high_resolution_clock::now();
 
@@ -206,145 +430,413 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	if (mirrorMode)
+	{
+		const auto mapNames = args::get(targets);
+		const std::string name = outputName ? args::get(outputName) : "mirrored.map";
+		for (size_t k = 0; k < mapNames.size(); ++k)
+		{
+			const std::string fileName = mapNames.size() > 1 ? makeMapFileName(name, k) : name;
+			std::ofstream file(fileName);
+			for (const TransferMap& map : readMaps(mapNames[k]))
+				file << mirrorMap(map, mirrorSourcesFlag);
+			std::cout << "Mirrored \"" << mapNames[k] << "\" to \"" << fileName << "\".\n";
+		}
+
+		return 0;
+	}
+
+	if (mergeMode)
+	{
+		std::vector<ShardHeader> headers;
+		std::vector<std::vector<TransferMap>> shardMaps;
+		for (const std::string& name : args::get(targets))
+		{
+			std::ifstream file(name);
+			ShardHeader& header = headers.emplace_back();
+			if (!(file >> header))
+			{
+				std::cerr << "[Error] The file \"" << name << "\" is not the output of a shard.\n";
+				return 1;
+			}
+			shardMaps.push_back(readMaps(file));
+		}
+
+		const std::vector<TransferMap> maps = mergeShards(headers, shardMaps);
+		if (maps.empty())
+			return 1;
+		const std::string name = outputName ? args::get(outputName) : "merged.map";
+		std::ofstream file(name);
+		for (const TransferMap& map : maps)
+			file << map;
+		std::cout << "Merged " << headers.size() << " shards into \"" << name << "\".\n";
+
+		return 0;
+	}
+
 	// load reference sprites
+	auto loadReference = [&](const std::string& _name)
+	{
+		SpriteSheet sheet(_name, args::get(framesInput));
+		sf::Image sprite = std::move(sheet.frames[args::get(refFrame)]);
+		setZeroAlpha(sprite);
+		return sprite;
+	};
 	std::vector<sf::Image> referenceSprites;
 	const auto inputNames = args::get(inputs);
 	referenceSprites.reserve(inputNames.size());
 	for (const auto& name : inputNames)
-	{
-		SpriteSheet sheet(name, args::get(framesInput));
-		referenceSprites.emplace_back(sheet.frames[args::get(refFrame)]);
-	}
-	for (sf::Image& sprite : referenceSprites) setZeroAlpha(sprite);
+		referenceSprites.push_back(loadReference(name));
 
 	const auto targetNames = args::get(targets);
 
 	if (createMode)
 	{
-		if (targetNames.size() != referenceSprites.size())
-		{
-			std::cerr << "[Error] The number of inputs (" << referenceSprites.size()
-				<< ") and the number of targets (" << targetNames.size() << ") need to be equal.\n";
-			return 1;
-		}
-		std::cout << "Building a transfer map from " << targetNames.size() 
-			<< (targetNames.size() > 1 ? " samples.\n" : " sample.\n");
+		// the references are loaded and preprocessed once for all jobs
+		const std::vector<sf::Image>& sharedSprites = referenceSprites;
+		std::vector<std::shared_ptr<const SourcePlanes>> sharedPlanes;
+		for (const sf::Image& sprite : sharedSprites)
+			sharedPlanes.push_back(std::make_shared<const SourcePlanes>(sprite));
 
-		// load targets
-		const int numFrames = args::get(framesTarget);
-		std::vector<SpriteSheet> targetSheets;
-		targetSheets.reserve(targetNames.size());
-		for (auto& name : targetNames)
+		auto createMaps = [&](const CreateJob& _job) -> int
 		{
-			targetSheets.emplace_back(name, numFrames);
-			targetSheets.back().applyZeroAlpha();
-		}
+			const std::vector<std::string>& targetNames = _job.targetNames;
+			const bool hasZoneMap = _job.zoneMap || zoneMapFlag;
+			// images that belong to this job, i.e. its zone map and the cropped references
+			std::vector<sf::Image> jobSprites;
+			std::vector<const sf::Image*> referenceSprites;
+			std::vector<std::shared_ptr<const SourcePlanes>> sourcePlanes;
+			if (_job.zoneMap)
+			{
+				jobSprites.emplace_back(loadReference(_job.zoneMap->first));
+				referenceSprites.push_back(&jobSprites.back());
+				sourcePlanes.push_back(std::make_shared<const SourcePlanes>(jobSprites.back()));
+			}
+			for (const sf::Image& sprite : sharedSprites)
+				referenceSprites.push_back(&sprite);
+			sourcePlanes.insert(sourcePlanes.end(), sharedPlanes.begin(), sharedPlanes.end());
 
-		const sf::Vector2u originalSize = referenceSprites.front().getSize();
-		sf::Vector2u originalPosition;
-		const int minBorder = args::get(cropMinBorder);
-		if (minBorder)
-		{
-			std::vector<const sf::Image*> sprites;
-			for (const auto& sprite : referenceSprites)
-				sprites.push_back(&sprite);
-			for (const SpriteSheet& sheet : targetSheets)
-				for (const sf::Image& sprite : sheet.frames)
-					sprites.push_back(&sprite);
-			sf::IntRect minRect = computeMinRect(sprites, minBorder);
-			originalPosition = sf::Vector2u(minRect.left, minRect.top);
-
-			for (sf::Image& sprite : referenceSprites)
-				sprite = cropImage(sprite, minRect);
-			for (SpriteSheet& sheet : targetSheets)
-				sheet.crop(minRect);
-		}
+			if (targetNames.size() + (_job.zoneMap ? 1 : 0) != referenceSprites.size())
+			{
+				std::cerr << "[Error] The number of inputs (" << sharedSprites.size()
+					<< ") and the number of targets (" << targetNames.size() << ") need to be equal.\n";
+				return 1;
+			}
+			std::cout << "Building a transfer map from " << targetNames.size() 
+				<< (targetNames.size() > 1 ? " samples.\n" : " sample.\n");
+
+			// load targets
+			const int numFrames = args::get(framesTarget);
+			std::vector<SpriteSheet> targetSheets;
+			targetSheets.reserve(targetNames.size());
+			if (_job.zoneMap)
+			{
+				targetSheets.emplace_back(_job.zoneMap->second, numFrames);
+				targetSheets.back().applyZeroAlpha();
+			}
+			for (auto& name : targetNames)
+			{
+				targetSheets.emplace_back(name, numFrames);
+				targetSheets.back().applyZeroAlpha();
+			}
 
-		// construct transfer maps and store them
-		const std::string mapName = args::get(outputName);
-		std::ofstream file(mapName);
-		std::vector<sf::Image> confidenceImgs;
-
-		auto [type, kernel] = parseSimilarityArg(args::get(similarityMeasure));
-
-		MapMaker maker{ zoneMapFlag, 
-			numFrames, 
-			referenceSprites, 
-			targetSheets, 
-			args::get(discardTreshold),
-			numThreads,
-			minBorder,
-			originalSize,
-			originalPosition,
-			mapName,
-			file,
-			debugFlag,
-			confidenceImgs,
-			kernel,
-			args::get(chainMaxTimeInSec)};
-
-		switch (type)
-		{
-		case SimilarityType::Identity: maker.run<IdentityDistance, GroupDistanceThreshold>();
-			break;
-		case SimilarityType::Equality: maker.run<KernelDistance, GroupDistanceThreshold>();
-			break;
-		case SimilarityType::Blur: maker.run<BlurDistance, GroupDistanceThreshold>();
-			break;
-		case SimilarityType::EqualityRotInv:maker.run<RotInvariantKernelDistance, GroupDistanceThreshold>();
-			break;
-		case SimilarityType::MinEquality: maker.run<KernelDistance, GroupMinDistance>();
-			break;
-		case SimilarityType::MinBlur: maker.run<BlurDistance, GroupMinDistance>();
-			break;
-		case SimilarityType::MinEqualityRotInv:maker.run<RotInvariantKernelDistance, GroupMinDistance>();
-			break;
-		case SimilarityType::Chain: maker.runChains();
-			break;
-#ifdef WITH_TORCH
-		case SimilarityType::MSEOptim:
-			for (size_t i = 0; i < numFrames; ++i)
+			const sf::Vector2u originalSize = referenceSprites.front()->getSize();
+			sf::Vector2u originalPosition;
+			const int minBorder = args::get(cropMinBorder);
+			if (minBorder)
 			{
-				if (kernel.size.x != kernel.size.y)
+				std::vector<const sf::Image*> sprites;
+				for (const sf::Image* sprite : referenceSprites)
+					sprites.push_back(sprite);
+				for (const SpriteSheet& sheet : targetSheets)
+					for (const sf::Image& sprite : sheet.frames)
+						sprites.push_back(&sprite);
+				sf::IntRect minRect = computeMinRect(sprites, minBorder);
+				originalPosition = sf::Vector2u(minRect.left, minRect.top);
+
+				// the shared references stay unchanged for the other jobs
+				std::vector<sf::Image> croppedSprites;
+				croppedSprites.reserve(referenceSprites.size());
+				for (const sf::Image* sprite : referenceSprites)
+					croppedSprites.push_back(cropImage(*sprite, minRect));
+				jobSprites = std::move(croppedSprites);
+				for (size_t j = 0; j < jobSprites.size(); ++j)
+					referenceSprites[j] = &jobSprites[j];
+				for (SpriteSheet& sheet : targetSheets)
+					sheet.crop(minRect);
+				// the shared planes are not cropped
+				sourcePlanes.clear();
+			}
+
+			// construct transfer maps and store them
+			const std::string& mapName = _job.mapName;
+			std::vector<sf::Image> confidenceImgs;
+
+			std::vector<std::string> similarityArgs = args::get(similarityMeasures);
+			if (similarityArgs.empty())
+				similarityArgs.push_back(defaultSimilarity);
+			const bool isMultiple = similarityArgs.size() > 1;
+			// with multiple measures each one gets its own file
+			std::ofstream file;
+			if (!isMultiple)
+				file.open(mapName);
+
+			std::string similarityArg = similarityArgs.front();
+			std::string firstStageArg;
+			std::string secondStageArg;
+			float cascadeMargin = 0.f;
+			const bool isCascade = parseCascadeArg(similarityArg, cascadeMargin, firstStageArg, secondStageArg);
+			if (isCascade)
+				similarityArg = secondStageArg;
+			auto [type, kernel] = parseSimilarityArg(similarityArg);
+
+			MapMaker maker{ hasZoneMap, 
+				numFrames, 
+				referenceSprites, 
+				targetSheets, 
+				args::get(discardTreshold),
+				numThreads,
+				minBorder,
+				originalSize,
+				originalPosition,
+				mapName,
+				file,
+				debugFlag,
+				confidenceImgs,
+				kernel,
+				args::get(chainMaxTimeInSec)};
+			maker.useActiveRegion = !fullSearchFlag;
+			maker.reuseFrames = !noReuseFlag;
+			maker.sourcePlanes = std::move(sourcePlanes);
+			maker.resume = resumeFlag;
+			maker.logPrefix = _job.logPrefix;
+			maker.keepCheckpoints = keepCheckpointsFlag;
+			maker.chainTimeBudgetInSec = args::get(chainTimeBudgetInSec);
+			for (const std::string& arg : similarityArgs)
+				maker.checkpointKey += arg + "\n";
+			if (shardArg)
+			{
+				maker.shard = parseShardArg(args::get(shardArg));
+				if (!maker.shard)
 				{
-					std::cout << "[Warning] Ignoring they y-size because mseoptim always uses a square kernel.\n";
+					std::cerr << "[Error] Invalid shard \"" << args::get(shardArg) << "\", expected \"i/n\" with i < n.\n";
+					return 1;
 				}
-				std::vector<sf::Image> dstImages;
-				dstImages.reserve(targetSheets.size());
-				for (auto& sheet : targetSheets)
-					dstImages.push_back(sheet.frames[i]);
-				const unsigned numEpochs = kernel[0] <= 1.f ? 200 : static_cast<unsigned>(kernel[0]);
-				auto map = nn::constructMapOptim(referenceSprites, dstImages, numThreads, kernel.size.x, numEpochs);
-				
-				if (minBorder)
-					map = extendMap(map, originalSize, originalPosition);
-				file << map;
+				// the seeds would differ from a single run
+				if (temporalThreshold)
+				{
+					std::cerr << "[Error] Temporal seeding can not be combined with shards.\n";
+					return 1;
+				}
+			}
+			if (temporalThreshold)
+				maker.temporalThreshold = args::get(temporalThreshold);
+			if (mirrorMapName)
+			{
+				const sf::IntRect cropRect(sf::Vector2i(originalPosition), sf::Vector2i(referenceSprites.front()->getSize()));
+				for (const TransferMap& map : readMaps(args::get(mirrorMapName)))
+				{
+					if (map.size != originalSize)
+					{
+						std::cerr << "[Error] The mirror map with size (" << map.size.x << ", " << map.size.y 
+							<< ") does not fit the targets with size (" << originalSize.x << ", " << originalSize.y << ").\n";
+						return 1;
+					}
+					if (maker.mirrorSeeds.size() == static_cast<size_t>(numFrames))
+						break;
+					maker.mirrorSeeds.push_back(cropMap(mirrorMap(map, mirrorSourcesFlag), cropRect));
+				}
+				if (maker.mirrorSeeds.size() < static_cast<size_t>(numFrames))
+					std::cout << "[Warning] The mirror map only covers the first " << maker.mirrorSeeds.size() 
+						<< " of " << numFrames << " frames.\n";
+				maker.mirrorThreshold = args::get(mirrorThreshold);
 			}
-			break;
-		case SimilarityType::EqualityMSEOptim:
-			auto makeOptimSimilarity = [&](size_t frame)
+
+	#ifdef WITH_TORCH
+			// the optimization takes the images themselves
+			auto copyReferences = [&]()
 			{
-				std::vector<sf::Image> dstImages;
-				dstImages.reserve(targetSheets.size());
-				for (auto& sheet : targetSheets)
-					dstImages.push_back(sheet.frames[frame]);
-				auto map = nn::constructMapOptim(referenceSprites, dstImages, numThreads, 5, 128);
-				return ScaleDistance(MapDistance(map), 0.5f);
+				std::vector<sf::Image> images;
+				images.reserve(referenceSprites.size());
+				for (const sf::Image* sprite : referenceSprites)
+					images.push_back(*sprite);
+				return images;
 			};
-			maker.run<KernelDistance, GroupDistanceThreshold>(makeOptimSimilarity);
-			break;
-#endif
-		default:
-			std::cerr << "[Error] Invalid similarity type " << static_cast<int>(type) << ".\n";
-			return 1;
+	#endif
+			auto runSimilarity = [&](SimilarityType _type)
+			{
+				switch (_type)
+				{
+				case SimilarityType::Identity: maker.run<IdentityDistance, GroupDistanceThreshold>();
+					break;
+				case SimilarityType::Equality: maker.run<KernelDistance, GroupDistanceThreshold>();
+					break;
+				case SimilarityType::Blur: maker.run<BlurDistance, GroupDistanceThreshold>();
+					break;
+				case SimilarityType::EqualityRotInv:maker.run<RotInvariantKernelDistance, GroupDistanceThreshold>();
+					break;
+				case SimilarityType::MinEquality: maker.run<KernelDistance, GroupMinDistance>();
+					break;
+				case SimilarityType::MinBlur: maker.run<BlurDistance, GroupMinDistance>();
+					break;
+				case SimilarityType::MinEqualityRotInv:maker.run<RotInvariantKernelDistance, GroupMinDistance>();
+					break;
+				case SimilarityType::Chain: maker.runChains();
+					break;
+	#ifdef WITH_TORCH
+				case SimilarityType::MSEOptim:
+					for (size_t i = 0; i < numFrames; ++i)
+					{
+						if (maker.kernel.size.x != maker.kernel.size.y)
+						{
+							std::cout << "[Warning] Ignoring they y-size because mseoptim always uses a square kernel.\n";
+						}
+						std::vector<sf::Image> dstImages;
+						dstImages.reserve(targetSheets.size());
+						for (auto& sheet : targetSheets)
+							dstImages.push_back(sheet.frames[i]);
+						const unsigned numEpochs = maker.kernel[0] <= 1.f ? 200 : static_cast<unsigned>(maker.kernel[0]);
+						auto map = nn::constructMapOptim(copyReferences(), dstImages, numThreads, maker.kernel.size.x, numEpochs);
+					
+						if (minBorder)
+							map = extendMap(map, originalSize, originalPosition);
+						file << map;
+					}
+					break;
+				case SimilarityType::EqualityMSEOptim:
+				{
+					auto makeOptimSimilarity = [&](size_t frame)
+					{
+						std::vector<sf::Image> dstImages;
+						dstImages.reserve(targetSheets.size());
+						for (auto& sheet : targetSheets)
+							dstImages.push_back(sheet.frames[frame]);
+						auto map = nn::constructMapOptim(copyReferences(), dstImages, numThreads, 5, 128);
+						return ScaleDistance(MapDistance(map), 0.5f);
+					};
+					maker.run<KernelDistance, GroupDistanceThreshold>(makeOptimSimilarity);
+					break;
+				}
+	#endif
+				default:
+					return false;
+				};
+				return true;
+			};
+
+			if (isMultiple)
+			{
+				std::vector<std::function<AnyDistance(int)>> makeDistances;
+				std::vector<std::ofstream> files;
+				unsigned activeRadius = 0;
+				for (size_t k = 0; k < similarityArgs.size(); ++k)
+				{
+					float margin;
+					std::string first, second;
+					if (parseCascadeArg(similarityArgs[k], margin, first, second))
+					{
+						std::cerr << "[Error] A cascade can not be combined with other similarity measures.\n";
+						return 1;
+					}
+					auto [measureType, measureKernel] = parseSimilarityArg(similarityArgs[k]);
+					auto makeDistance = makeDistanceFactory(maker, measureType, measureKernel);
+					if (!makeDistance)
+					{
+						std::cerr << "[Error] The similarity type " << SIMILARITY_TYPE_NAMES[static_cast<size_t>(measureType)]
+							<< " can not be combined with other similarity measures.\n";
+						return 1;
+					}
+					makeDistances.push_back(std::move(makeDistance));
+					activeRadius = std::max(activeRadius, MapMaker::kernelRadius(measureKernel));
+
+					const std::string fileName = makeMapFileName(mapName, k);
+					std::cout << "Writing the maps for \"" << similarityArgs[k] << "\" to \"" << fileName << "\".\n";
+					files.emplace_back(fileName);
+				}
+				if (temporalThreshold)
+					std::cout << "[Warning] Temporal seeding is not supported with multiple similarity measures and is ignored.\n";
+				if (mirrorMapName)
+					std::cout << "[Warning] A mirror map is not supported with multiple similarity measures and is ignored.\n";
+				maker.runMultiple(makeDistances, files, activeRadius);
+			}
+			else
+			{
+				if (isCascade)
+				{
+					auto [firstType, firstKernel] = parseSimilarityArg(firstStageArg);
+					if (!isCascadeStage(firstType) || !isCascadeStage(type))
+					{
+						std::cerr << "[Error] The similarity types " << SIMILARITY_TYPE_NAMES[static_cast<size_t>(firstType)]
+							<< " and " << SIMILARITY_TYPE_NAMES[static_cast<size_t>(type)] << " can not be combined in a cascade.\n";
+						return 1;
+					}
+					maker.cascade.emplace();
+					maker.cascade->marginThreshold = cascadeMargin;
+					maker.cascade->maps.resize(numFrames);
+					maker.cascade->margins.resize(numFrames);
+
+					std::cout << _job.logPrefix + "Running the first stage of the cascade.\n";
+					maker.kernel = firstKernel;
+					runSimilarity(firstType);
+
+					maker.cascade->isFirstStage = false;
+					maker.kernel = kernel;
+					std::cout << _job.logPrefix + "Running the second stage of the cascade.\n";
+				}
+
+				if (!runSimilarity(type))
+				{
+					std::cerr << "[Error] Invalid similarity type " << static_cast<int>(type) << ".\n";
+					return 1;
+				}
+			}
+
+			if (debugFlag)
+			{
+				SpriteSheet sheet(std::move(confidenceImgs));
+				sheet.save(_job.confidenceName);
+			}
+
+
+			return 0;
 		};
 
-		if (debugFlag)
+		if (jobsFileName)
+		{
+			if (args::get(cropMinBorder))
+			{
+				std::cerr << "[Error] A job list can not be combined with cropping.\n";
+				return 1;
+			}
+			const std::vector<CreateJob> jobs = readJobs(args::get(jobsFileName));
+			if (jobs.empty())
+			{
+				std::cerr << "[Error] The job list does not contain any jobs.\n";
+				return 1;
+			}
+			std::cout << "Running " << jobs.size() << " jobs.\n";
+			// the jobs share the pool with the frames of each job
+			std::atomic<int> numFailed = 0;
+			utils::TaskGroup jobTasks;
+			for (const CreateJob& job : jobs)
+				jobTasks.run([&createMaps, &numFailed, &job]()
+					{
+						if (createMaps(job) != 0)
+						{
+							std::cerr << "[Error] The job for \"" << job.mapName << "\" failed.\n";
+							++numFailed;
+						}
+					});
+			jobTasks.wait();
+			if (numFailed)
+				return 1;
+		}
+		else
 		{
-			SpriteSheet sheet(std::move(confidenceImgs));
-			sheet.save("confidence.png");
+			const int result = createMaps(CreateJob{ targetNames, args::get(outputName) });
+			if (result != 0)
+				return result;
 		}
-
 	}
 	else if (applyMode)
 	{
@@ -353,27 +845,9 @@ int main(int argc, char* argv[])
 		transferMaps.reserve(targetNames.size());
 		for (auto& name : targetNames)
 		{
-			if (!std::filesystem::exists(name))
-			{
-				std::cout << "[Warning] Skipping the map "
-					<< name << " as the file could not be found.\n";
-				continue;
-			}
-			auto& sheetMaps = transferMaps.emplace_back();
-			std::ifstream file(name);
-			while (file)
-			{
-				sheetMaps.emplace_back();
-				file >> sheetMaps.back();
-			}
-			// an empty map is read before encountering eof
-			if (sheetMaps.back().size.x == 0)
-				sheetMaps.pop_back();
-			if (sheetMaps.empty())
-			{
-				std::cout << "[Warning] The file " << name << " does not contain a valid map.\n";
-				transferMaps.pop_back();
-			}
+			std::vector<TransferMap> sheetMaps = readMaps(name);
+			if (!sheetMaps.empty())
+				transferMaps.push_back(std::move(sheetMaps));
 		}
 
 		if (debugFlag)
@@ -394,7 +868,6 @@ int main(int argc, char* argv[])
 			for (size_t j = 0; j < transferMaps.size(); ++j)
 			{
 				auto& mapSheet = transferMaps[j];
-				SpriteSheet sheet;
 				for (TransferMap& map : mapSheet)
 				{
 					if (map.size != reference.getSize())
@@ -405,9 +878,14 @@ int main(int argc, char* argv[])
 							<< reference.getSize().x << ", " << reference.getSize().y << ")";
 						std::abort();
 					}
-					else
-						sheet.frames.emplace_back(applyMap(map, reference));
 				}
+				SpriteSheet sheet;
+				sheet.frames.resize(mapSheet.size());
+				utils::runMultiThreaded(size_t(0), mapSheet.size(), [&](size_t begin, size_t end)
+					{
+						for (size_t k = begin; k < end; ++k)
+							sheet.frames[k] = applyMap(mapSheet[k], reference);
+					}, numThreads);
 				const std::filesystem::path mapName = targetNames[j];
 				const std::string objectName = args::get(outputName);
 				const std::string fileName = objectName + "_" + mapName.stem().string() + ".png";
@@ -1,5 +1,8 @@
 #include "mapmaker.hpp"
 
+#include <cmath>
+#include <cstring>
+
 // ************************************************************* //
 void MapMaker::runChains()
 {
@@ -9,32 +12,327 @@ void MapMaker::runChains()
 		std::cerr << "[Error] Distance measure \"chains\" requires a zone map consisting of single pixel lines.\n";
 		std::abort();
 	}
+	if (shard)
+	{
+		std::cerr << "[Error] Distance measure \"chains\" can not be split into shards.\n";
+		std::abort();
+	}
 	if (referenceSprites.size() > 1 || targetSheets.size() > 1)
 	{
 		std::cout << "[Warning] Redundant inputs for distance measure \"chains\". Only the zone map is currently used in this mode.\n";
 	}
+	if (!mirrorSeeds.empty())
+	{
+		std::cout << "[Warning] The mirror map is ignored by distance measure \"chains\".\n";
+	}
 
 	const auto orientationHeuristic = static_cast<OrientationHeuristic>(kernel.size.x);
+	// the reference chains are shared by all frames, so their issues are only reported once
+	utils::Diagnostics referenceDiagnostics;
+	const ReferenceChains referenceChains(*referenceSprites[0],
+		std::make_shared<const ZoneIndex>(*referenceSprites[0], true),
+		chainMaxTimeInSec,
+		chainTimeBudgetInSec,
+		numThreads,
+		referenceDiagnostics);
+	referenceDiagnostics.print(std::cout, originalPosition);
 
-	auto makeFn = [&](int i, ErrorImageWrapper& errorRefImage, ErrorImageWrapper& errorTargetImage) 
+	auto makeFn = [&](int i, ErrorImageWrapper& errorRefImage, ErrorImageWrapper& errorTargetImage,
+		utils::Diagnostics& diagnostics) 
 	{
-		// create zonemaps for both sprites
-		const ZoneMap srcZoneMap(referenceSprites[0], targetSheets[0].frames[i], true);
-		const ZoneMap dstZoneMap(targetSheets[0].frames[i], referenceSprites[0], true);
+		const ZoneIndex dstZones(targetSheets[0].frames[i], true);
 
 		// we dont use the actual target
-		TransferMap map = constructMap(referenceSprites[0], 
+		TransferMap map = constructMap(*referenceSprites[0], 
 			targetSheets[0].frames[i],
-			srcZoneMap,
-			dstZoneMap,
+			referenceChains,
+			dstZones,
 			orientationHeuristic,
 			errorRefImage,
 			errorTargetImage,
-			chainMaxTimeInSec
+			chainMaxTimeInSec,
+			chainTimeBudgetInSec,
+			numThreads,
+			diagnostics
 		);
 
 		return map;
 	};
 
-	makeForEachFrame(makeFn);
-}
\ No newline at end of file
+	// the chains depend on the position of the target zones
+	makeForEachFrame(makeFn, findReusableFrames(), nullptr, &referenceDiagnostics);
+}
+// ************************************************************* //
+void MapMaker::runMultiple(const std::vector<std::function<AnyDistance(int)>>& _makeDistances,
+	std::vector<std::ofstream>& _files,
+	unsigned _activeRadius)
+{
+	assert(_makeDistances.size() == _files.size());
+
+	const std::shared_ptr<const ZoneIndex> referenceZones = makeReferenceZones();
+	auto makeFn = [&](int i, ErrorImageWrapper& errorRefImage, ErrorImageWrapper& errorTargetImage,
+		utils::Diagnostics& diagnostics)
+	{
+		const std::unique_ptr<ZoneMap> zoneMap = makeZoneMap(i, referenceZones);
+
+		std::vector<AnyDistance> distances;
+		distances.reserve(_makeDistances.size());
+		for (const auto& makeDistance : _makeDistances)
+			distances.push_back(makeDistance(i));
+
+		MapSearchOptions options;
+		options.diagnostics = &diagnostics;
+		ActiveRegion active;
+		if (useActiveRegion)
+		{
+			active = makeActiveRegion(i, _activeRadius);
+			options.targetMask = &active.targets;
+			options.candidates = &active.candidates;
+		}
+		PixelMask shardMask;
+		if (shard)
+		{
+			shardMask = makeShardMask(i, options.targetMask);
+			options.targetMask = &shardMask;
+		}
+
+		auto results = constructMaps(distances, zoneMap.get(), numThreads, originalPosition, options);
+
+		std::vector<TransferMap> maps;
+		maps.reserve(results.size());
+		for (auto& [map, confidence] : results)
+			maps.push_back(std::move(map));
+		// only the confidence of the first measure is shown
+		if (debugFlag)
+			confidenceImgs[i] = matToImage(results.front().second);
+
+		return maps;
+	};
+
+	// any of the measures may depend on the position
+	makeForEachFrame(makeFn, findReusableFrames(), &_files);
+}
+
+// ************************************************************* //
+std::shared_ptr<const ZoneIndex> MapMaker::makeReferenceZones() const
+{
+	if (!zoneMapFlag)
+		return nullptr;
+	return std::make_shared<const ZoneIndex>(*referenceSprites[0]);
+}
+
+std::unique_ptr<ZoneMap> MapMaker::makeZoneMap(int _frame, const std::shared_ptr<const ZoneIndex>& _referenceZones) const
+{
+	if (!_referenceZones)
+		return nullptr;
+	return std::make_unique<ZoneMap>(_referenceZones, targetSheets[0].frames[_frame]);
+}
+
+// ************************************************************* //
+std::uint64_t MapMaker::hashSettings() const
+{
+	utils::Hash hash;
+	hash.add(checkpointKey);
+	hash.add(static_cast<std::uint64_t>(zoneMapFlag));
+	hash.add(discardThreshold);
+	hash.add(static_cast<std::uint64_t>(kernel.size.x));
+	hash.add(static_cast<std::uint64_t>(kernel.size.y));
+	for (float weight : kernel.elements)
+		hash.add(weight);
+	hash.add(chainMaxTimeInSec);
+	hash.add(chainTimeBudgetInSec);
+	hash.add(static_cast<std::uint64_t>(useActiveRegion));
+	hash.add(temporalThreshold.value_or(-1.f));
+	hash.add(mirrorThreshold);
+	hash.add(cascade ? cascade->marginThreshold : -1.f);
+	hash.add(static_cast<std::uint64_t>(shard ? shard->index : 0));
+	hash.add(static_cast<std::uint64_t>(shard ? shard->count : 0));
+	hash.add(static_cast<std::uint64_t>(originalPosition.x));
+	hash.add(static_cast<std::uint64_t>(originalPosition.y));
+
+	for (const sf::Image* sprite : referenceSprites)
+	{
+		const ImageView view(*sprite);
+		hash.add(static_cast<std::uint64_t>(view.getSize().x));
+		hash.add(static_cast<std::uint64_t>(view.getSize().y));
+		for (unsigned y = 0; y < view.getSize().y; ++y)
+			for (unsigned x = 0; x < view.getSize().x; ++x)
+				hash.add(static_cast<std::uint64_t>(view(x, y)));
+	}
+
+	return hash.value();
+}
+
+std::uint64_t MapMaker::hashFrame(int _frame, std::uint64_t _base) const
+{
+	utils::Hash hash;
+	hash.add(_base);
+	for (const SpriteSheet& sheet : targetSheets)
+	{
+		const ImageView view(sheet.frames[_frame]);
+		for (unsigned y = 0; y < view.getSize().y; ++y)
+			for (unsigned x = 0; x < view.getSize().x; ++x)
+				hash.add(static_cast<std::uint64_t>(view(x, y)));
+	}
+	if (static_cast<size_t>(_frame) < mirrorSeeds.size())
+	{
+		for (const sf::Vector2u& src : mirrorSeeds[_frame].elements)
+			hash.add(static_cast<std::uint64_t>(src.x) << 32 | src.y);
+	}
+
+	return hash.value();
+}
+
+std::filesystem::path MapMaker::checkpointDirectory() const
+{
+	return std::filesystem::path(mapName + ".checkpoints");
+}
+
+std::filesystem::path MapMaker::checkpointPath(int _frame) const
+{
+	return checkpointDirectory() / ("frame_" + std::to_string(_frame) + ".map");
+}
+
+bool MapMaker::loadCheckpoint(int _frame, std::uint64_t _hash, std::vector<TransferMap>& _maps) const
+{
+	std::ifstream in(checkpointPath(_frame));
+	return readCheckpoint(in, _hash, referenceSprites.front()->getSize(), _maps);
+}
+
+void MapMaker::saveCheckpoint(int _frame, std::uint64_t _hash, const std::vector<TransferMap>& _maps) const
+{
+	const std::filesystem::path path = checkpointPath(_frame);
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+	{
+		std::ofstream out(tempPath);
+		writeCheckpoint(out, _hash, _maps);
+		if (!out)
+		{
+			std::cout << "[Warning] Could not write the checkpoint " << tempPath << ".\n";
+			return;
+		}
+	}
+	// a rename within the same directory replaces the old checkpoint atomically
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+		std::cout << "[Warning] Could not commit the checkpoint " << path << ": " << error.message() << "\n";
+}
+
+// ************************************************************* //
+sf::Image MapMaker::mergeIssueImages(const std::vector<sf::Image>& _images) const
+{
+	const sf::Vector2u size = referenceSprites.front()->getSize();
+	ImageBuffer merged(size, sf::Color(0, 0, 0, 0));
+	const MutableImageView mergedView = merged.view();
+	const PackedColor empty = packColor(sf::Color(0, 0, 0, 0));
+	for (const sf::Image& image : _images)
+	{
+		const ImageView view(image);
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+			{
+				const PackedColor color = view(x, y);
+				if (color != empty)
+					mergedView.setPixel(x, y, color);
+			}
+	}
+
+	return merged.toImage();
+}
+
+// ************************************************************* //
+MapMaker::ActiveRegion MapMaker::makeActiveRegion(int _frame, unsigned _radius) const
+{
+	// the zone map is included so that inactive targets are in the same zone as their identity
+	std::vector<ImageView> images;
+	for (size_t j = 0; j < targetSheets.size(); ++j)
+	{
+		images.emplace_back(*referenceSprites[j]);
+		images.emplace_back(targetSheets[j].frames[_frame]);
+	}
+
+	ActiveRegion region;
+	region.targets = makeActiveMask(images, _radius);
+	region.candidates = maskToPixelList(region.targets);
+
+	// all inactive sources have the same distance to any target
+	const auto inactive = std::find(region.targets.begin(), region.targets.end(), 0);
+	if (inactive != region.targets.end())
+	{
+		const size_t ind = std::distance(region.targets.begin(), inactive);
+		region.candidates.insert(std::lower_bound(region.candidates.begin(), region.candidates.end(), ind), ind);
+	}
+
+	return region;
+}
+
+// ************************************************************* //
+std::vector<std::optional<MapMaker::FrameReuse>> MapMaker::findReusableFrames() const
+{
+	std::vector<std::optional<FrameReuse>> reuse(numFrames);
+	// with temporal seeding the map also depends on the previous frames
+	if (!reuseFrames || temporalThreshold)
+		return reuse;
+
+	// all inputs that differ between frames, the zone map is the first target sheet
+	auto isEqualFrame = [&](int _frame, int _source)
+	{
+		for (const SpriteSheet& sheet : targetSheets)
+		{
+			const ImageView view(sheet.frames[_frame]);
+			const ImageView sourceView(sheet.frames[_source]);
+			for (unsigned y = 0; y < view.getSize().y; ++y)
+				if (std::memcmp(view.row(y), sourceView.row(y), 4 * view.getSize().x) != 0)
+					return false;
+		}
+		const bool hasSeed = static_cast<size_t>(_frame) < mirrorSeeds.size();
+		const bool sourceHasSeed = static_cast<size_t>(_source) < mirrorSeeds.size();
+		return hasSeed == sourceHasSeed && (!hasSeed || mirrorSeeds[_frame] == mirrorSeeds[_source]);
+	};
+
+	std::vector<std::uint64_t> hashes(numFrames);
+	for (int i = 0; i < numFrames; ++i)
+	{
+		// frames with and without a mirror seed are distinguished by the base
+		const bool hasSeed = static_cast<size_t>(i) < mirrorSeeds.size();
+		hashes[i] = hashFrame(i, hasSeed);
+	}
+
+	for (int i = 0; i < numFrames; ++i)
+	{
+		// sources are never reused themselves, since equal frames share the same source
+		for (int k = 0; k < i; ++k)
+		{
+			if (reuse[k] || hashes[k] != hashes[i] || !isEqualFrame(i, k))
+				continue;
+			reuse[i] = FrameReuse{ k };
+			break;
+		}
+	}
+
+	return reuse;
+}
+
+PixelMask MapMaker::makeShardMask(int _frame, const PixelMask* _mask) const
+{
+	// rows are counted in the uncropped sprite so that the split does not depend on the crop
+	const sf::Vector2u size = referenceSprites.front()->getSize();
+	PixelMask mask(size);
+	for (unsigned y = 0; y < size.y; ++y)
+	{
+		if (!shard->ownsRow(_frame, y + originalPosition.y, originalSize.y))
+			continue;
+		for (unsigned x = 0; x < size.x; ++x)
+			mask(x, y) = _mask ? (*_mask)(x, y) : 1;
+	}
+
+	return mask;
+}
+
+unsigned MapMaker::kernelRadius(const math::Matrix<float>& _kernel)
+{
+	const float halfSize = std::max(_kernel.size.x, _kernel.size.y) * 0.5f;
+	return static_cast<unsigned>(std::ceil(halfSize * std::sqrt(2.f)));
+}
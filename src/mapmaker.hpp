@@ -2,8 +2,18 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 #include <vector>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <limits>
+#include <filesystem>
+#include <cstdint>
 #include "core/map.hpp"
 #include "core/pixelsimilarity.hpp"
 #include "core/pixelchains.hpp"
@@ -14,7 +24,8 @@ struct MapMaker
 {
 	bool zoneMapFlag;
 	int numFrames;
-	std::vector<sf::Image>& referenceSprites;
+	// not owned, the first one is the zone map if zoneMapFlag is set
+	const std::vector<const sf::Image*>& referenceSprites;
 	std::vector<SpriteSheet>& targetSheets;
 	float discardThreshold;
 	unsigned numThreads;
@@ -25,110 +36,537 @@ struct MapMaker
 	std::ofstream& file;
 	bool debugFlag;
 	std::vector<sf::Image>& confidenceImgs;
-	const math::Matrix<float>& kernel;
+	math::Matrix<float> kernel;
 	float chainMaxTimeInSec;
+	// Time for all chain searches of a frame, negative for no limit.
+	float chainTimeBudgetInSec = -1.f;
+	// Put in front of the progress messages, e.g. to tell concurrent jobs apart.
+	std::string logPrefix = {};
+
+	// State of a cascade over two measures. The first stage keeps its maps and margins
+	// in memory instead of writing them. The second stage only searches targets where 
+	// the margin is below marginThreshold and takes the first stage result elsewhere.
+	struct Cascade
+	{
+		float marginThreshold = 0.f;
+		bool isFirstStage = true;
+		std::vector<TransferMap> maps;
+		std::vector<math::Matrix<float>> margins;
+
+		PixelMask makeTargetMask(int _frame) const
+		{
+			const math::Matrix<float>& margin = margins[_frame];
+			PixelMask mask(margin.size);
+			for (size_t i = 0; i < PixelMask::numElements(mask.size); ++i)
+				mask[i] = margin[i] < marginThreshold;
+			return mask;
+		}
+	};
+	std::optional<Cascade> cascade = {};
+
+	// Only search targets and candidates that are not transparent in all inputs.
+	bool useActiveRegion = true;
+
+	// If set, frames are created in order and each search starts from the map of
+	// the previous frame. Seeds with at most this distance are accepted.
+	std::optional<float> temporalThreshold = {};
+	TransferMap temporalSeed = {};
+
+	// Take the map of an earlier frame for frames with the same targets.
+	bool reuseFrames = true;
+
+	// Each finished frame is committed to <mapName>.checkpoints together with a hash of
+	// its inputs. If set, frames with a matching checkpoint are loaded instead of created.
+	bool resume = false;
+	// Otherwise the checkpoints are removed once all maps are written.
+	bool keepCheckpoints = false;
+	// Describes the measures and all other settings that are not part of the MapMaker.
+	std::string checkpointKey = {};
+
+	// If set, only the rows of this shard are searched and the output starts with a ShardHeader.
+	std::optional<Shard> shard = {};
+	// Restrict _mask to the rows of the shard. An empty _mask selects all targets.
+	PixelMask makeShardMask(int _frame, const PixelMask* _mask) const;
+
+	// Preprocessed reference sprites, shared by all frames and possibly by other
+	// MapMakers with the same references. Either empty or one for each reference sprite.
+	std::vector<std::shared_ptr<const SourcePlanes>> sourcePlanes = {};
+
+	// Maps of the other facing, already mirrored, for the first frames. The search of a 
+	// target starts from the mirrored map and stops if its distance is at most mirrorThreshold.
+	// Takes precedence over the temporal seed.
+	std::vector<TransferMap> mirrorSeeds = {};
+	float mirrorThreshold = 0.f;
+
+	// A frame that equals an earlier frame in all targets and per frame inputs.
+	struct FrameReuse
+	{
+		int source;
+	};
+	// Find the frames that can take the map of an earlier frame. Only exact duplicates
+	// are reused, since ties are broken towards the identity, which depends on the position.
+	// Frames are never reused with temporal seeding.
+	std::vector<std::optional<FrameReuse>> findReusableFrames() const;
+
+	// Pixels that need to be searched for a frame. Elsewhere all inputs are
+	// transparent including the kernel support, so the identity is a perfect match.
+	struct ActiveRegion
+	{
+		PixelMask targets;
+		// Active sources and one inactive source that represents all the others.
+		PixelList candidates;
+	};
+	ActiveRegion makeActiveRegion(int _frame, unsigned _radius) const;
+	// Radius of the pixels that a kernel can access, including any rotation.
+	static unsigned kernelRadius(const math::Matrix<float>& _kernel);
 
 	// run with pixel chains
 	void runChains();
 
+	// Construct the distance measure of the similarity search for frame _frame.
+	template<typename Similarity, template<typename> class Group, typename MakeSimilarity = int, bool WithId = false>
+	auto makeDistance(int _frame, const math::Matrix<float>& _kernel, const MakeSimilarity& _othSimilarity = 0) const
+	{
+		using SimilarityT = std::conditional_t<WithId,
+			MaskCompositionDistance<IdentityDistance, Similarity>,
+			Similarity>;
+		using GroupSimilarity = Group<Similarity>;
+		std::vector<SimilarityT> distances;
+
+		auto makeSimilarity = [&](size_t j)
+		{
+			const ImageView target(targetSheets[j].frames[_frame]);
+			if constexpr (std::is_constructible_v<Similarity, const SourcePlanes&, const ImageView&, const math::Matrix<float>&>)
+			{
+				if (!sourcePlanes.empty())
+					return Similarity(*sourcePlanes[j], target, _kernel);
+			}
+			return Similarity(*referenceSprites[j], target, _kernel);
+		};
+
+		// the first pair is the zone map
+		for (size_t j = zoneMapFlag ? 1 : 0; j < targetSheets.size(); ++j)
+		{
+			if constexpr (WithId)
+				distances.emplace_back(IdentityDistance(*referenceSprites[j], targetSheets[j].frames[_frame], _kernel),
+					makeSimilarity(j));
+			else
+				distances.push_back(makeSimilarity(j));
+		}
+
+		auto constructGroupSim = [&]()
+		{
+			if constexpr (std::is_constructible_v<GroupSimilarity, std::vector<SimilarityT>, float>)
+				return GroupSimilarity(std::move(distances), discardThreshold);
+			else
+				return GroupSimilarity(std::move(distances));
+		};
+
+		if constexpr (std::is_same_v<MakeSimilarity, int>)
+			return constructGroupSim();
+		else
+			return SumDistance(constructGroupSim(), _othSimilarity(_frame));
+	}
+
 	// run with color similarity search
 	template<typename Similarity, template<typename> class Group, typename MakeSimilarity = int, bool WithId = false>
 	void run(const MakeSimilarity& _othSimilarity = 0)
 	{
-		auto makeFn = [&](int i, ErrorImageWrapper& errorRefImage, ErrorImageWrapper& errorTargetImage) {
-			using SimilarityT = std::conditional_t<WithId,
-				MaskCompositionDistance<IdentityDistance, Similarity>,
-				Similarity>;
-			using GroupSimilarity = Group<Similarity>;
-			std::vector<SimilarityT> distances;
-			// make zone map
-			std::unique_ptr<ZoneMap> zoneMap;
-			if (zoneMapFlag)
-				zoneMap = std::make_unique<ZoneMap>(referenceSprites[0], targetSheets[0].frames[i]);
-
-			for (size_t j = zoneMap ? 1 : 0; j < targetSheets.size(); ++j)
+		temporalSeed = {};
+		const std::shared_ptr<const ZoneIndex> referenceZones = makeReferenceZones();
+		auto makeFn = [&](int i, ErrorImageWrapper& errorRefImage, ErrorImageWrapper& errorTargetImage,
+			utils::Diagnostics& diagnostics) {
+			const std::unique_ptr<ZoneMap> zoneMap = makeZoneMap(i, referenceZones);
+
+			MapSearchOptions options;
+			options.diagnostics = &diagnostics;
+			if (static_cast<size_t>(i) < mirrorSeeds.size())
 			{
-				if constexpr (WithId)
-					distances.emplace_back(IdentityDistance(referenceSprites[j], targetSheets[j].frames[i], kernel),
-						Similarity(referenceSprites[j], targetSheets[j].frames[i], kernel));
-				else
-					distances.emplace_back(referenceSprites[j], targetSheets[j].frames[i], kernel);
+				options.seedMap = &mirrorSeeds[i];
+				options.seedRadius = 0;
+				options.seedThreshold = mirrorThreshold;
 			}
-
-			auto constructGroupSim = [&]()
+			else if (temporalThreshold && temporalSeed.size.x != 0)
 			{
-				if constexpr (std::is_constructible_v<GroupSimilarity, std::vector<SimilarityT>, float>)
-					return GroupSimilarity(std::move(distances), discardThreshold);
-				else
-					return GroupSimilarity(std::move(distances));
-			};
-			auto constructFullSim = [&]()
+				options.seedMap = &temporalSeed;
+				options.seedThreshold = *temporalThreshold;
+			}
+			math::Matrix<float> margin;
+			ActiveRegion active;
+			if (useActiveRegion)
+			{
+				active = makeActiveRegion(i, kernelRadius(kernel));
+				options.targetMask = &active.targets;
+				options.candidates = &active.candidates;
+			}
+			PixelMask targetMask;
+			if (cascade)
 			{
-				if constexpr (std::is_same_v<MakeSimilarity, int>)
-					return constructGroupSim();
+				if (cascade->isFirstStage)
+					options.margin = &margin;
 				else
-					return SumDistance(constructGroupSim(), _othSimilarity(i));
-			};
+				{
+					targetMask = cascade->makeTargetMask(i);
+					if (useActiveRegion)
+					{
+						for (size_t j = 0; j < targetMask.elements.size(); ++j)
+							targetMask[j] &= active.targets[j];
+					}
+					options.targetMask = &targetMask;
+					options.initialMap = &cascade->maps[i];
+					const size_t numRefined = std::count_if(targetMask.begin(), targetMask.end(), 
+						[](sf::Uint8 _flag) { return _flag != 0; });
+					// a single write so that the messages of concurrent frames do not interleave
+					std::ostringstream message;
+					message << logPrefix << "Refining " << numRefined << " of " << PixelMask::numElements(targetMask.size) 
+						<< " pixels in frame " << i << ".\n";
+					std::cout << message.str();
+				}
+			}
+			PixelMask shardMask;
+			if (shard)
+			{
+				shardMask = makeShardMask(i, options.targetMask);
+				options.targetMask = &shardMask;
+			}
 
-			auto [map, confidence] = constructMap(constructFullSim(),
+			auto [map, confidence] = constructMap(makeDistance<Similarity, Group, MakeSimilarity, WithId>(i, kernel, _othSimilarity),
 				zoneMap.get(),
 				numThreads,
-				originalPosition);
+				originalPosition,
+				options);
 
-			if (debugFlag)
-				confidenceImgs.emplace_back(matToImage(confidence));
+			if (temporalThreshold)
+				temporalSeed = map;
+
+			if (cascade && cascade->isFirstStage)
+			{
+				cascade->maps[i] = map;
+				cascade->margins[i] = std::move(margin);
+			}
+			else if (debugFlag)
+				confidenceImgs[i] = matToImage(confidence);
 
 			return map;
 		};
 
-		makeForEachFrame(makeFn);
+		makeForEachFrame(makeFn, findReusableFrames());
 	}
 
+	// Run several similarity searches in a single traversal of the candidates.
+	// @param _makeDistances Constructs one measure for a given frame, see makeDistance.
+	// @param _files One output for the maps of each measure.
+	// @param _activeRadius The largest kernel radius of all measures.
+	void runMultiple(const std::vector<std::function<AnyDistance(int)>>& _makeDistances,
+		std::vector<std::ofstream>& _files,
+		unsigned _activeRadius);
+
 private:
-	// create map for each frame
+	// The zones of the reference are the same for all frames and only built once per run.
+	// @return nullptr if no zone map is used.
+	std::shared_ptr<const ZoneIndex> makeReferenceZones() const;
+	std::unique_ptr<ZoneMap> makeZoneMap(int _frame, const std::shared_ptr<const ZoneIndex>& _referenceZones) const;
+
+	// Hash of the settings and references that are shared by all frames.
+	std::uint64_t hashSettings() const;
+	// Hash of all inputs of the map of _frame, starting from _base.
+	std::uint64_t hashFrame(int _frame, std::uint64_t _base) const;
+	std::filesystem::path checkpointDirectory() const;
+	std::filesystem::path checkpointPath(int _frame) const;
+	// @return False if there is no valid checkpoint with _hash.
+	bool loadCheckpoint(int _frame, std::uint64_t _hash, std::vector<TransferMap>& _maps) const;
+	// The checkpoint is written to a temporary file first so that it is either complete or missing.
+	void saveCheckpoint(int _frame, std::uint64_t _hash, const std::vector<TransferMap>& _maps) const;
+
+	// Merge the issues of each frame into one image. Later frames take precedence.
+	sf::Image mergeIssueImages(const std::vector<sf::Image>& _images) const;
+
+	// Create the maps of all frames in parallel. They are written in frame order
+	// as soon as all previous frames are done.
+	// @param _reuse Frames that take the map of an earlier frame, see findReusableFrames.
+	// @param _files If set, _makeFn returns one map for each file instead of a single map.
+	// @param _sharedDiagnostics Issues that belong to no single frame, e.g. of the reference.
+	//		They are listed in the issue report with the frame "ref".
 	template<typename MakeFn>
-	void makeForEachFrame(MakeFn _makeFn)
+	void makeForEachFrame(MakeFn _makeFn, 
+		const std::vector<std::optional<FrameReuse>>& _reuse,
+		std::vector<std::ofstream>* _files = nullptr,
+		const utils::Diagnostics* _sharedDiagnostics = nullptr)
 	{
-		const sf::Vector2u s = referenceSprites.front().getSize();
-		sf::Image errorRefImg;
-		errorRefImg.create(s.x, s.y, sf::Color(0,0,0,0));
-		ErrorImageWrapper errorRefWrapper(errorRefImg);
+		using Result = std::invoke_result_t<MakeFn, int, ErrorImageWrapper&, ErrorImageWrapper&, utils::Diagnostics&>;
 
+		const sf::Vector2u s = referenceSprites.front()->getSize();
+		sf::Image emptyImg;
+		emptyImg.create(s.x, s.y, sf::Color(0,0,0,0));
+
+		// each frame draws into its own images so that frames are independent
+		std::vector<sf::Image> errorRefImgs;
 		SpriteSheet errorSheet;
-		errorSheet.frames.resize(numFrames, errorRefImg);
+		errorSheet.frames.resize(numFrames, emptyImg);
+		std::vector<char> refIssues(numFrames, false);
+		std::vector<char> targetIssues(numFrames, false);
+		std::vector<std::string> issueReports(numFrames);
+		errorRefImgs.resize(numFrames, emptyImg);
+		if (debugFlag)
+			confidenceImgs.resize(numFrames);
 
-		bool highlightedErrors = false;
+		std::vector<std::optional<Result>> results(numFrames);
+		int nextToWrite = 0;
+		std::mutex writeMutex;
 
+		// results that are needed again for reused frames
+		std::vector<char> isSource(numFrames, false);
 		for (int i = 0; i < numFrames; ++i)
 		{
-			std::cout << "Creating map for frame " << i << "...\n";
+			if (!_reuse[i])
+				continue;
+			const FrameReuse& reuse = *_reuse[i];
+			isSource[reuse.source] = true;
+			std::cout << logPrefix << "Reusing the map of frame " << reuse.source << " for frame " << i << ".\n";
+		}
+		std::vector<std::optional<Result>> sourceResults(numFrames);
 
-			ErrorImageWrapper errorTargetWrapper(errorSheet.frames[i]);
+		auto toMaps = [](const Result& _result)
+		{
+			if constexpr (std::is_same_v<Result, TransferMap>)
+				return std::vector<TransferMap>{ _result };
+			else
+				return _result;
+		};
 
-			TransferMap map = _makeFn(i, errorRefWrapper, errorTargetWrapper);
+		// checkpoints of the final maps are always written, so that an interrupted run can be resumed
+		const bool isFinalStage = !(cascade && cascade->isFirstStage);
+		bool saveCheckpoints = isFinalStage;
+		if (saveCheckpoints)
+		{
+			std::error_code error;
+			std::filesystem::create_directories(checkpointDirectory(), error);
+			if (error)
+			{
+				std::cout << "[Warning] Could not create the checkpoint directory " << checkpointDirectory() 
+					<< ": " << error.message() << "\n";
+				saveCheckpoints = false;
+			}
+		}
+		const std::uint64_t settingsHash = hashSettings();
+		std::vector<std::uint64_t> frameHashes(numFrames);
+		for (int i = 0; i < numFrames; ++i)
+		{
+			// with temporal seeding the map also depends on all previous frames
+			const std::uint64_t base = temporalThreshold && i > 0 ? frameHashes[i - 1] : settingsHash;
+			frameHashes[i] = hashFrame(i, base);
+		}
+
+		// frames with an unchanged checkpoint are not created again
+		std::vector<std::optional<Result>> resumed(numFrames);
+		if (resume)
+		{
+			for (int i = 0; i < numFrames; ++i)
+			{
+				std::vector<TransferMap> maps;
+				if (_reuse[i] || !loadCheckpoint(i, frameHashes[i], maps))
+					continue;
+				if constexpr (std::is_same_v<Result, TransferMap>)
+				{
+					if (maps.size() == 1)
+						resumed[i] = std::move(maps.front());
+				}
+				else if (maps.size() == _files->size())
+					resumed[i] = std::move(maps);
+			}
+			const size_t numResumed = std::count_if(resumed.begin(), resumed.end(),
+				[](const std::optional<Result>& _maps) { return _maps.has_value(); });
+			if (numResumed)
+				std::cout << logPrefix << "Resuming " << numResumed << " frames from checkpoints.\n";
+		}
 
+		// the header is written once with the final maps
+		if (shard && !(cascade && cascade->isFirstStage))
+		{
+			ShardHeader header{ *shard,
+				sf::IntRect(sf::Vector2i(originalPosition), sf::Vector2i(referenceSprites.front()->getSize())) };
+			for (int i = 0; i < numFrames; ++i)
+				if (_reuse[i])
+					header.reusedFrames.push_back({ i, _reuse[i]->source });
+			if constexpr (std::is_same_v<Result, TransferMap>)
+				file << header;
+			else
+			{
+				for (std::ofstream& out : *_files)
+					out << header;
+			}
+		}
+
+		auto write = [&](std::ostream& _file, TransferMap& _map)
+		{
 			if (minBorder)
-				map = extendMap(map, originalSize, originalPosition);
-			file << map;
+				_map = extendMap(_map, originalSize, originalPosition);
+			_file << _map;
+		};
+
+		auto deliver = [&](int i, Result&& _maps)
+		{
+			// the map is only written once the last cascade stage is done
+			if (cascade && cascade->isFirstStage)
+				return;
+
+			// ordered writer: whoever completes the next frame writes all consecutive finished frames
+			std::scoped_lock lock(writeMutex);
+			results[i] = std::move(_maps);
+			for (; nextToWrite < numFrames && results[nextToWrite]; ++nextToWrite)
+			{
+				Result& frameMaps = *results[nextToWrite];
+				if constexpr (std::is_same_v<Result, TransferMap>)
+					write(file, frameMaps);
+				else
+				{
+					for (size_t k = 0; k < frameMaps.size(); ++k)
+						write((*_files)[k], frameMaps[k]);
+				}
+				results[nextToWrite].reset();
+			}
+		};
+
+		auto makeFrame = [&](int i)
+		{
+			if (resumed[i])
+			{
+				// the final maps are already known
+				if (cascade && cascade->isFirstStage)
+					return;
+				Result maps = std::move(*resumed[i]);
+				if constexpr (std::is_same_v<Result, TransferMap>)
+				{
+					if (temporalThreshold)
+						temporalSeed = maps;
+				}
+				if (isSource[i])
+					sourceResults[i] = maps;
+				deliver(i, std::move(maps));
+				return;
+			}
+
+			std::cout << (logPrefix + "Creating map for frame " + std::to_string(i) + "...\n");
+
+			ErrorImageWrapper errorRefWrapper(errorRefImgs[i]);
+			ErrorImageWrapper errorTargetWrapper(errorSheet.frames[i]);
+
+			utils::Diagnostics diagnostics;
+
+			Result maps = _makeFn(i, errorRefWrapper, errorTargetWrapper, diagnostics);
+			if (!diagnostics.empty())
+			{
+				errorRefWrapper.draw(diagnostics, utils::Diagnostics::Input::Reference);
+				errorTargetWrapper.draw(diagnostics, utils::Diagnostics::Input::Target);
+				// a single write so that the summaries of concurrent frames do not interleave
+				std::ostringstream summary;
+				summary << logPrefix << "Issues in frame " << i << ":\n";
+				diagnostics.print(summary, originalPosition);
+				std::cout << summary.str();
+				std::ostringstream report;
+				diagnostics.writeReport(report, std::to_string(i), originalPosition);
+				issueReports[i] = report.str();
+			}
+			refIssues[i] = !errorRefWrapper.isEmpty();
+			targetIssues[i] = !errorTargetWrapper.isEmpty();
+			if (saveCheckpoints)
+				saveCheckpoint(i, frameHashes[i], toMaps(maps));
+			if (isSource[i])
+				sourceResults[i] = maps;
+			deliver(i, std::move(maps));
+		};
 
-			highlightedErrors |= !errorTargetWrapper.isEmpty();
+		auto reuseFrame = [&](int i)
+		{
+			const FrameReuse& reuse = *_reuse[i];
+			if (cascade && cascade->isFirstStage)
+			{
+				// the source was resumed, so this frame is only derived from its final map
+				if (resumed[reuse.source])
+					return;
+				cascade->maps[i] = cascade->maps[reuse.source];
+				cascade->margins[i] = cascade->margins[reuse.source];
+			}
+			deliver(i, Result(*sourceResults[reuse.source]));
+		};
+
+		// with temporal seeding each frame depends on the previous one
+		if (temporalThreshold)
+		{
+			for (int i = 0; i < numFrames; ++i)
+				makeFrame(i);
+		}
+		else
+		{
+			utils::TaskGroup frameTasks;
+			for (int i = 0; i < numFrames; ++i)
+				if (!_reuse[i])
+					frameTasks.run([&makeFrame, i]() { makeFrame(i); });
+			frameTasks.wait();
+			// sources always come first, so the remaining frames complete the output in order
+			for (int i = 0; i < numFrames; ++i)
+				if (_reuse[i])
+					reuseFrame(i);
 		}
 
-		if (!errorRefWrapper.isEmpty())
+		// the checkpoints are only needed until the output is complete
+		if (saveCheckpoints && !keepCheckpoints && nextToWrite == numFrames)
 		{
-			errorRefImg = extendImage(errorRefImg, originalSize, originalPosition);
+			bool isWritten = true;
+			if constexpr (std::is_same_v<Result, TransferMap>)
+				isWritten = static_cast<bool>(file.flush());
+			else
+			{
+				for (std::ofstream& out : *_files)
+					isWritten &= static_cast<bool>(out.flush());
+			}
+			std::error_code error;
+			if (isWritten)
+				std::filesystem::remove_all(checkpointDirectory(), error);
+			if (error)
+				std::cout << "[Warning] Could not remove the checkpoints " << checkpointDirectory() 
+					<< ": " << error.message() << "\n";
+		}
+
+		// frames that were not searched, e.g. resumed ones, keep their place in the sheet
+		for (sf::Image& img : confidenceImgs)
+			if (img.getSize().x == 0)
+				img = emptyImg;
+
+		if (std::find(refIssues.begin(), refIssues.end(), true) != refIssues.end())
+		{
+			std::vector<sf::Image> issueImgs;
+			for (int i = 0; i < numFrames; ++i)
+				if (refIssues[i])
+					issueImgs.push_back(std::move(errorRefImgs[i]));
+			const sf::Image errorRefImg = extendImage(mergeIssueImages(issueImgs), originalSize, originalPosition);
 			const std::string fileName = mapName + ".ref_issues.png";
-			std::cout << "Issues where found in the reference input. Creating \"" << fileName << "\" to highlight them.\n";
+			std::cout << logPrefix << "Issues where found in the reference input. Creating \"" << fileName << "\" to highlight them.\n";
 			errorRefImg.saveToFile(fileName);
 		}
 
-		if (highlightedErrors)
+		if (std::find(targetIssues.begin(), targetIssues.end(), true) != targetIssues.end())
 		{
 			errorSheet.extend(originalSize, originalPosition);
 			
 			const std::string fileName = mapName + ".target_issues.png";
-			std::cout << "Issues where found in the target inputs. Creating \"" << fileName << "\" to highlight them.\n";
+			std::cout << logPrefix << "Issues where found in the target inputs. Creating \"" << fileName << "\" to highlight them.\n";
 			errorSheet.save(fileName);
 		}
+
+		std::ostringstream sharedReport;
+		if (_sharedDiagnostics)
+			_sharedDiagnostics->writeReport(sharedReport, "ref", originalPosition);
+		if (!sharedReport.str().empty()
+			|| std::any_of(issueReports.begin(), issueReports.end(), [](const std::string& _report) { return !_report.empty(); }))
+		{
+			const std::string fileName = mapName + ".issues.txt";
+			std::cout << logPrefix << "Writing a list of all issues to \"" << fileName << "\".\n";
+			std::ofstream reportFile(fileName);
+			reportFile << "frame kind input color count x y\n";
+			reportFile << sharedReport.str();
+			for (const std::string& report : issueReports)
+				reportFile << report;
+		}
 	}
-};
\ No newline at end of file
+};
@@ -1,13 +1,14 @@
 #pragma once
 
 #include "matrix.hpp"
+#include "../utils/imageview.hpp"
 #include <SFML/Graphics.hpp>
 
 #include <functional>
 
-// Access pixel x,y from _image. 
+// Access pixel x,y from _image.
 // If the coordinates lie outside the padded value is returned instead.
-inline sf::Color getPixelPadded(const sf::Image& _image, int x, int y)
+inline sf::Color getPixelPadded(const ImageView& _image, int x, int y)
 {
 	if (x < 0 || y < 0
 		|| x >= static_cast<int>(_image.getSize().x)
@@ -20,23 +21,40 @@ inline sf::Color getPixelPadded(const sf::Image& _image, int x, int y)
 }
 
 namespace math {
-	// perform a 2D convolution on an image
-	template<typename T, typename Distance, typename Reduce>
-	auto applyConvolution(const sf::Image& _image, const Matrix<T>& _kernel,
-		Distance _dist, Reduce _reduce)
+	// Image with an explicit border stored in an arbitrary memory layout.
+	template<typename Shape = TiledShape2D<>>
+	using PaddedImage = Matrix<sf::Color, Shape>;
+
+	// The value of the border, which is the default of sf::Image::create.
+	// It differs from the transparent pixels outside of the target (see getPixelPadded).
+	const sf::Color PADDING_COLOR = sf::Color(0, 0, 0, 255);
+
+	// Copy _image into a matrix with _border pixels of PADDING_COLOR on each side.
+	template<typename Shape = TiledShape2D<>>
+	PaddedImage<Shape> makePaddedImage(const ImageView& _image, const sf::Vector2u& _border)
+	{
+		const sf::Vector2u size = _image.getSize();
+		PaddedImage<Shape> padded(size + _border + _border, PADDING_COLOR);
+
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+				padded(x + _border.x, y + _border.y) = _image.getPixel(x, y);
+
+		return padded;
+	}
+
+	// Perform a 2D convolution on an image that is already padded by half the kernel size.
+	// The access only goes through (x,y) so that any layout of _padded can be used.
+	// @param _size The size of the image without padding.
+	template<typename T, typename Distance, typename Reduce, typename Shape>
+	auto applyConvolution(const PaddedImage<Shape>& _padded, const sf::Vector2u& _size,
+		const Matrix<T>& _kernel, Distance _dist, Reduce _reduce)
 	{
 		using ReturnType = typename decltype(std::function{ _reduce })::result_type;
 		using DistanceType = typename decltype(std::function{ _dist })::result_type;
 
-		const sf::Vector2u size = _image.getSize();
-		const sf::Vector2u kernelHalf(_kernel.size.x / 2, _kernel.size.y / 2);
-
-		// explicit padding
-		sf::Image paddedImg;
-		paddedImg.create(size.x + _kernel.size.x-1, size.y + _kernel.size.y - 1);
-		paddedImg.copy(_image, kernelHalf.x, kernelHalf.y);
-		const sf::Uint8* pixels = paddedImg.getPixelsPtr();
-		const sf::Vector2u paddedSize = paddedImg.getSize();
+		assert(_padded.size.x + 1 >= _size.x + _kernel.size.x
+			&& _padded.size.y + 1 >= _size.y + _kernel.size.y);
 
 		// result matrix can be reused
 		Matrix<DistanceType> kernelResult(_kernel.size);
@@ -44,30 +62,35 @@ namespace math {
 		{
 			for (unsigned i = 0; i < _kernel.size.y; ++i)
 			{
-				const unsigned yInd = (y + i - kernelHalf.y);
-				const unsigned yFlat = yInd * paddedSize.x;
 				for (unsigned j = 0; j < _kernel.size.x; ++j)
 				{
-					const unsigned xInd = x + j - kernelHalf.x;
 					const unsigned kernelInd = j + i * _kernel.size.x;
-					// sf::Image::getPixel but inline
-					const sf::Uint8* pixel = &pixels[4 * (xInd + yFlat)];
-					const sf::Color fastCol(pixel[0], pixel[1], pixel[2], pixel[3]);
-
-					kernelResult[kernelInd] = _dist(_kernel[kernelInd], fastCol);
+					kernelResult[kernelInd] = _dist(_kernel[kernelInd], _padded(x + j, y + i));
 				}
 			}
 			return _reduce(kernelResult);
 		};
 
-		Matrix<ReturnType> result(_image.getSize());
+		Matrix<ReturnType> result(_size);
 
-		for (unsigned y = 0; y < size.y; ++y)
-			for (unsigned x = 0; x < size.x; ++x)
+		for (unsigned y = 0; y < _size.y; ++y)
+			for (unsigned x = 0; x < _size.x; ++x)
 			{
-				result(x, y) = computeKernel(x+kernelHalf.x, y+kernelHalf.y);
+				result(x, y) = computeKernel(x, y);
 			}
 
 		return result;
 	}
-}
\ No newline at end of file
+
+	// perform a 2D convolution on an image
+	template<typename T, typename Distance, typename Reduce>
+	auto applyConvolution(const ImageView& _image, const Matrix<T>& _kernel,
+		Distance _dist, Reduce _reduce)
+	{
+		// explicit padding
+		const sf::Vector2u kernelHalf(_kernel.size.x / 2, _kernel.size.y / 2);
+		const PaddedImage<> paddedImg = makePaddedImage(_image, kernelHalf);
+
+		return applyConvolution(paddedImg, _image.getSize(), _kernel, _dist, _reduce);
+	}
+}
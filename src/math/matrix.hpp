@@ -3,6 +3,9 @@
 #include <SFML/System/Vector2.hpp>
 #include <cassert>
 #include <iostream>
+#include <tuple>
+#include <functional>
+#include <algorithm>
 #include "../utils/utils.hpp"
 
 namespace math {
@@ -25,12 +28,123 @@ namespace math {
 			return sf::Vector2u(static_cast<unsigned>(flat % size.x),
 				static_cast<unsigned>(flat / size.x));
 		}
+
+		// number of elements required to store an array of _size
+		static size_t numElements(const sf::Vector2u& _size)
+		{
+			return static_cast<size_t>(_size.x) * static_cast<size_t>(_size.y);
+		}
+	};
+
+	// Layout where square tiles of TILE_SIZE x TILE_SIZE elements are stored
+	// contiguously (row-major inside a tile and the tiles row-major among each other).
+	// Small 2D neighbourhoods are then only spread over one or few cache lines.
+	// The size is padded to full tiles so the array can contain elements
+	// outside of size which are never accessed through (x,y).
+	template<unsigned TileBits = 3>
+	struct TiledShape2D
+	{
+		static constexpr unsigned TILE_SIZE = 1u << TileBits;
+		static constexpr unsigned TILE_MASK = TILE_SIZE - 1;
+
+		sf::Vector2u size;
+
+		size_t flatIndex(unsigned x, unsigned y) const
+		{
+			const size_t tile = (x >> TileBits) + static_cast<size_t>(y >> TileBits) * numTiles(size.x);
+			return (tile << (2 * TileBits)) + ((y & TILE_MASK) << TileBits) + (x & TILE_MASK);
+		}
+		size_t flatIndex(const sf::Vector2u& _index) const
+		{
+			return flatIndex(_index.x, _index.y);
+		}
+
+		sf::Vector2u index(size_t flat) const
+		{
+			const size_t tile = flat >> (2 * TileBits);
+			const unsigned inTile = static_cast<unsigned>(flat) & (TILE_SIZE * TILE_SIZE - 1);
+			const size_t tilesX = numTiles(size.x);
+			return sf::Vector2u(static_cast<unsigned>(tile % tilesX) * TILE_SIZE + (inTile & TILE_MASK),
+				static_cast<unsigned>(tile / tilesX) * TILE_SIZE + (inTile >> TileBits));
+		}
+
+		static size_t numElements(const sf::Vector2u& _size)
+		{
+			return numTiles(_size.x) * numTiles(_size.y) * TILE_SIZE * TILE_SIZE;
+		}
+	private:
+		static size_t numTiles(unsigned _elements) { return (_elements + TILE_MASK) >> TileBits; }
+	};
+
+	template<typename T, typename Shape>
+	struct Matrix;
+
+	namespace details {
+		template<typename E>
+		struct IsMatrixExpression : std::false_type {};
+
+		template<typename E>
+		constexpr bool isMatrixExpression = IsMatrixExpression<std::remove_cv_t<std::remove_reference_t<E>>>::value;
+
+		// Operands of an expression are kept by reference if they are lvalues.
+		// Temporaries are moved into the expression so that it can not dangle.
+		template<typename E>
+		using ExpressionOperand = std::conditional_t<std::is_lvalue_reference_v<E>,
+			const std::remove_reference_t<E>&,
+			std::remove_cv_t<std::remove_reference_t<E>>>;
+	}
+
+	// Lazily evaluated element-wise operation on matrices or other expressions.
+	// Nothing is computed until the expression is assigned to a Matrix, which
+	// then happens in a single loop without temporary matrices.
+	template<typename Op, typename... Operands>
+	struct MatrixExpression
+	{
+		Op op;
+		std::tuple<Operands...> operands;
+
+		auto operator[](size_t _flat) const
+		{
+			return std::apply([&](const auto&... _operand) { return op(_operand[_flat]...); }, operands);
+		}
+
+		// size and layout of the result
+		const auto& shape() const { return std::get<0>(operands).shape(); }
 	};
 
+	namespace details {
+		template<typename T, typename Shape>
+		struct IsMatrixExpression<Matrix<T, Shape>> : std::true_type {};
+		template<typename Op, typename... Operands>
+		struct IsMatrixExpression<MatrixExpression<Op, Operands...>> : std::true_type {};
+
+		template<typename Op, typename... Operands>
+		auto makeExpression(Op _op, Operands&&... _operands)
+		{
+			using ShapeT = std::decay_t<decltype(std::get<0>(std::forward_as_tuple(_operands...)).shape())>;
+			static_assert((std::is_same_v<ShapeT, std::decay_t<decltype(_operands.shape())>> && ...),
+				"All operands need to have the same layout.");
+			assert(((std::get<0>(std::forward_as_tuple(_operands...)).shape().size == _operands.shape().size) && ...));
+
+			return MatrixExpression<Op, ExpressionOperand<Operands&&>...>{ _op,
+				std::tuple<ExpressionOperand<Operands&&>...>(std::forward<Operands>(_operands)...) };
+		}
+
+		template<typename E, typename M>
+		constexpr bool isOtherExpression = isMatrixExpression<E> && !std::is_same_v<std::decay_t<E>, M>;
+	}
+
 	// dynamic sized matrix
-	template<typename T>
-	struct Matrix : public ArrayShape2D
+	// @param Shape The memory layout, either ArrayShape2D (row-major) or TiledShape2D.
+	//				Access through (x,y) is independent of the layout while the flat 
+	//				index and the order of begin(), end() are not.
+	template<typename T, typename Shape = ArrayShape2D>
+	struct Matrix : public Shape
 	{
+		using Shape::size;
+		using Shape::flatIndex;
+		using Shape::index;
+
 		Matrix() = default;
 		explicit Matrix(const sf::Vector2u& _size, const T& _default = {})
 		{
@@ -42,10 +156,32 @@ namespace math {
 			loadBinary(_stream);
 		}
 
+		// evaluate an expression
+		template<typename E, typename = std::enable_if_t<details::isOtherExpression<E, Matrix>>>
+		Matrix(const E& _expression)
+		{
+			*this = _expression;
+		}
+
+		template<typename E, typename = std::enable_if_t<details::isOtherExpression<E, Matrix>>>
+		Matrix& operator=(const E& _expression)
+		{
+			static_assert(std::is_same_v<std::decay_t<decltype(_expression.shape())>, Shape>,
+				"The expression needs to have the same layout.");
+			// only resize if necessary since the expression may reference this matrix
+			const sf::Vector2u newSize = _expression.shape().size;
+			if (size != newSize)
+				resize(newSize);
+			for (size_t i = 0; i < elements.size(); ++i)
+				elements[i] = _expression[i];
+
+			return *this;
+		}
+
 		void resize(const sf::Vector2u& _size, const T& _default = {})
 		{
 			size = _size;
-			elements.resize(static_cast<size_t>(size.x) * static_cast<size_t>(size.y), _default);
+			elements.resize(Shape::numElements(size), _default);
 		}
 
 		// direct access through flat index
@@ -59,6 +195,8 @@ namespace math {
 		const T& operator()(const sf::Vector2u& _index) const { return elements[flatIndex(_index)]; }
 		T& operator()(const sf::Vector2u& _index) { return elements[flatIndex(_index)]; }
 
+		const Shape& shape() const { return *this; }
+
 		auto begin() const { return elements.begin(); }
 		auto end() const { return elements.end(); }
 		auto begin() { return elements.begin(); }
@@ -136,56 +274,69 @@ namespace math {
 		std::vector<T> elements;
 	};
 
-	template<typename T>
-	Matrix<T> operator+(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename Lhs, typename Rhs,
+		typename = std::enable_if_t<details::isMatrixExpression<Lhs> && details::isMatrixExpression<Rhs>>>
+	auto operator+(Lhs&& lhs, Rhs&& rhs)
 	{
-		assert(lhs.size == rhs.size);
-
-		Matrix<T> result = lhs;
-		for (size_t i = 0; i < lhs.elements.size(); ++i)
-			result[i] += rhs[i];
+		return details::makeExpression(std::plus<>{}, std::forward<Lhs>(lhs), std::forward<Rhs>(rhs));
+	}
 
-		return result;
+	template<typename Lhs, typename Rhs,
+		typename = std::enable_if_t<details::isMatrixExpression<Lhs> && details::isMatrixExpression<Rhs>>>
+	auto operator-(Lhs&& lhs, Rhs&& rhs)
+	{
+		return details::makeExpression(std::minus<>{}, std::forward<Lhs>(lhs), std::forward<Rhs>(rhs));
 	}
 
-	template<typename T>
-	Matrix<T>& operator+=(Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename Lhs, typename Rhs,
+		typename = std::enable_if_t<details::isMatrixExpression<Lhs> && details::isMatrixExpression<Rhs>>>
+	auto min(Lhs&& lhs, Rhs&& rhs)
 	{
-		assert(lhs.size == rhs.size);
+		auto minOp = [](const auto& a, const auto& b) { return std::min(a, b); };
+		return details::makeExpression(minOp, std::forward<Lhs>(lhs), std::forward<Rhs>(rhs));
+	}
 
-		for (size_t i = 0; i < lhs.elements.size(); ++i)
-			lhs[i] += rhs[i];
+	template<typename Lhs, typename T,
+		typename = std::enable_if_t<details::isMatrixExpression<Lhs> && !details::isMatrixExpression<T>>>
+	auto operator*(Lhs&& lhs, T rhs)
+	{
+		auto scaleOp = [rhs](const auto& a) { return a * rhs; };
+		return details::makeExpression(scaleOp, std::forward<Lhs>(lhs));
+	}
 
-		return lhs;
+	template<typename T, typename Rhs,
+		typename = std::enable_if_t<!details::isMatrixExpression<T> && details::isMatrixExpression<Rhs>>>
+	auto operator*(T lhs, Rhs&& rhs)
+	{
+		return std::forward<Rhs>(rhs) * lhs;
 	}
 
-	template<typename T>
-	Matrix<T>& operator*=(Matrix<T>& lhs, T rhs)
+	template<typename T, typename Shape, typename E, 
+		typename = std::enable_if_t<details::isMatrixExpression<E>>>
+	Matrix<T, Shape>& operator+=(Matrix<T, Shape>& lhs, const E& rhs)
 	{
+		assert(lhs.size == rhs.shape().size);
+
 		for (size_t i = 0; i < lhs.elements.size(); ++i)
-			lhs[i] *= rhs;
+			lhs[i] += rhs[i];
 
 		return lhs;
 	}
 
-	template<typename T>
-	Matrix<T> operator-(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename T, typename Shape>
+	Matrix<T, Shape>& operator*=(Matrix<T, Shape>& lhs, T rhs)
 	{
-		assert(lhs.size == rhs.size);
-
-		Matrix<T> result = lhs;
 		for (size_t i = 0; i < lhs.elements.size(); ++i)
-			result[i] -= rhs[i];
+			lhs[i] *= rhs;
 
-		return result;
+		return lhs;
 	}
 
-	template<typename T>
-	bool operator==(const Matrix<T>& lhs, const Matrix<T>& rhs)
+	template<typename T, typename Shape>
+	bool operator==(const Matrix<T, Shape>& lhs, const Matrix<T, Shape>& rhs)
 	{
 		if (lhs.size != rhs.size) return false;
 
-		Matrix<T> result = lhs;
 		for (size_t i = 0; i < lhs.elements.size(); ++i)
 			if (lhs[i] != rhs[i])
 				return false;
@@ -193,28 +344,17 @@ namespace math {
 		return true;
 	}
 
-	template<typename T>
-	Matrix<T> min(const Matrix<T>& lhs, const Matrix<T>& rhs)
-	{
-		assert(lhs.size == rhs.size);
-
-		Matrix<T> result(lhs.size);
-		for (size_t i = 0; i < lhs.elements.size(); ++i)
-			result[i] = std::min(lhs[i], rhs[i]);
-		return result;
-	}
-
-	template<typename T, typename = std::enable_if_t<utils::is_stream_writable<std::ostream, T>::value>>
+	template<typename T, typename Shape, typename = std::enable_if_t<utils::is_stream_writable<std::ostream, T>::value>>
 //	requires requires (T x) { std::declval<std::ofstream>()  << x; }
-	std::ostream& operator<<(std::ostream& _out, const Matrix<T>& _matrix)
+	std::ostream& operator<<(std::ostream& _out, const Matrix<T, Shape>& _matrix)
 	{
 		_matrix.save(_out);
 		return _out;
 	}
 
-	template<typename T, typename = std::enable_if_t<utils::is_stream_readable<std::istream, T>::value>>
+	template<typename T, typename Shape, typename = std::enable_if_t<utils::is_stream_readable<std::istream, T>::value>>
 //	requires requires (T x) { std::declval<std::ifstream>() >> x; }
-	std::istream& operator>>(std::istream& _in, Matrix<T>& _matrix)
+	std::istream& operator>>(std::istream& _in, Matrix<T, Shape>& _matrix)
 	{
 		_matrix.load(_in);
 		return _in;
@@ -0,0 +1,158 @@
+#include "diagnostics.hpp"
+#include "colors.hpp"
+
+#include <algorithm>
+#include <tuple>
+#include <iomanip>
+
+namespace utils {
+	using Issue = Diagnostics::Issue;
+
+	static bool isSameIssue(const Issue& _issue, Diagnostics::Kind _kind, Diagnostics::Input _input, sf::Color _color)
+	{
+		return _issue.kind == _kind && _issue.input == _input && _issue.color == _color;
+	}
+
+	static void addIssue(std::vector<Issue>& _issues, Diagnostics::Kind _kind, Diagnostics::Input _input,
+		sf::Color _color, sf::Vector2u _position)
+	{
+		// consecutive issues mostly belong to the same zone
+		auto it = std::find_if(_issues.rbegin(), _issues.rend(), [&](const Issue& _issue)
+			{
+				return isSameIssue(_issue, _kind, _input, _color);
+			});
+		if (it != _issues.rend())
+			it->positions.push_back(_position);
+		else
+			_issues.push_back(Issue{ _kind, _input, _color, { _position } });
+	}
+
+	// ************************************************************* //
+	void Diagnostics::Local::add(Kind _kind, Input _input, sf::Color _color, sf::Vector2u _position)
+	{
+		addIssue(m_issues, _kind, _input, _color, _position);
+	}
+
+	void Diagnostics::add(Kind _kind, Input _input, sf::Color _color, sf::Vector2u _position)
+	{
+		std::scoped_lock lock(m_mutex);
+		addIssue(m_issues, _kind, _input, _color, _position);
+	}
+
+	void Diagnostics::merge(std::vector<Issue>& _issues)
+	{
+		if (_issues.empty())
+			return;
+
+		std::scoped_lock lock(m_mutex);
+		for (Issue& issue : _issues)
+		{
+			auto it = std::find_if(m_issues.begin(), m_issues.end(), [&](const Issue& _issue)
+				{
+					return isSameIssue(_issue, issue.kind, issue.input, issue.color);
+				});
+			if (it != m_issues.end())
+				it->positions.insert(it->positions.end(), issue.positions.begin(), issue.positions.end());
+			else
+				m_issues.push_back(std::move(issue));
+		}
+	}
+
+	bool Diagnostics::empty() const
+	{
+		std::scoped_lock lock(m_mutex);
+		return m_issues.empty();
+	}
+
+	std::vector<Issue> Diagnostics::issues() const
+	{
+		std::vector<Issue> issues;
+		{
+			std::scoped_lock lock(m_mutex);
+			issues = m_issues;
+		}
+
+		// the order of the threads should not change the output
+		auto key = [](const Issue& _issue)
+		{
+			return std::make_tuple(_issue.kind, _issue.input, _issue.color.toInteger());
+		};
+		std::sort(issues.begin(), issues.end(), [&](const Issue& _a, const Issue& _b)
+			{
+				return key(_a) < key(_b);
+			});
+		for (Issue& issue : issues)
+		{
+			std::vector<sf::Vector2u>& positions = issue.positions;
+			std::sort(positions.begin(), positions.end(), [](const sf::Vector2u& _a, const sf::Vector2u& _b)
+				{
+					return std::tie(_a.y, _a.x) < std::tie(_b.y, _b.x);
+				});
+			positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+		}
+
+		return issues;
+	}
+
+	// ************************************************************* //
+	void Diagnostics::print(std::ostream& _out, sf::Vector2u _offset) const
+	{
+		for (const Issue& issue : issues())
+		{
+			const char* inputName = issue.input == Input::Reference ? "reference" : "target";
+			const sf::Vector2u first = issue.positions.front() + _offset;
+			_out << "[Warning] ";
+			switch (issue.kind)
+			{
+			case Kind::MissingZone:
+				_out << "Zone map is invalid. The color (" << issue.color
+					<< ") does not exist in the reference";
+				break;
+			case Kind::ChainTimeout:
+				_out << "Timeout during " << inputName << " chain construction of the zone with color ("
+					<< issue.color << "). Results might not be deterministic. The chain is probably too wide";
+				break;
+			case Kind::MultipleChainStarts:
+				_out << "Encountered multiple starting points in a " << inputName << " chain with color ("
+					<< issue.color << ")";
+				break;
+			case Kind::MisplacedChainStart:
+				_out << "Pixel chain start marker is not at one of the ends in a " << inputName
+					<< " chain with color (" << issue.color << ")";
+				break;
+			case Kind::UnmatchedChainStart:
+				_out << "Found a chain start marker in the target but not in the source zone with color ("
+					<< issue.color << ") (alpha channel is ignored)";
+				break;
+			case Kind::ChainDeadline:
+				_out << "Time budget was used up during " << inputName << " chain construction of the zone with color ("
+					<< issue.color << "). The best chain found so far is used";
+				break;
+			default:
+				_out << "Unknown issue with color (" << issue.color << ")";
+			}
+
+			if (issue.positions.size() == 1)
+				_out << ". Found at " << first.x << ", " << first.y << ".\n";
+			else
+			{
+				_out << ". Found at " << issue.positions.size() << " pixels, the first is at "
+					<< first.x << ", " << first.y << ".\n";
+			}
+		}
+	}
+
+	void Diagnostics::writeReport(std::ostream& _out, const std::string& _prefix, sf::Vector2u _offset) const
+	{
+		for (const Issue& issue : issues())
+		{
+			const sf::Vector2u first = issue.positions.front() + _offset;
+			const sf::Uint32 color = issue.color.toInteger();
+			_out << _prefix << " " << DIAGNOSTIC_KIND_NAMES[static_cast<size_t>(issue.kind)]
+				<< " " << (issue.input == Input::Reference ? "reference" : "target")
+				<< " " << std::hex << std::setfill('0') << std::setw(8) << color << std::dec << std::setfill(' ')
+				<< " " << issue.positions.size()
+				<< " " << first.x << " " << first.y << "\n";
+		}
+	}
+}
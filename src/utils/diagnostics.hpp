@@ -0,0 +1,95 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+
+#include <vector>
+#include <array>
+#include <string>
+#include <mutex>
+#include <ostream>
+
+namespace utils {
+	// Collects the issues with the inputs that are found while a map is created.
+	// Issues of the same kind and color, e.g. all pixels of an invalid zone, are
+	// aggregated so that they are reported once instead of for every pixel.
+	class Diagnostics
+	{
+	public:
+		enum struct Kind
+		{
+			MissingZone,         //< a target color does not exist in the reference
+			ChainTimeout,
+			MultipleChainStarts,
+			MisplacedChainStart, //< start marker is not at an end of the chain
+			UnmatchedChainStart, //< start marker only exists in the target
+			ChainDeadline,       //< the time budget ended before the chain was finished
+			COUNT
+		};
+
+		// The image in which an issue was found.
+		enum struct Input
+		{
+			Reference,
+			Target
+		};
+
+		struct Issue
+		{
+			Kind kind;
+			Input input;
+			sf::Color color;
+			// distinct positions in row-major order
+			std::vector<sf::Vector2u> positions;
+		};
+
+		// Buffer of a single thread that is merged into the collector when it is destroyed.
+		// Adding to it requires no synchronization.
+		class Local
+		{
+		public:
+			explicit Local(Diagnostics& _diagnostics) : m_diagnostics(_diagnostics) {}
+			~Local() { m_diagnostics.merge(m_issues); }
+
+			Local(const Local&) = delete;
+			Local& operator=(const Local&) = delete;
+
+			void add(Kind _kind, Input _input, sf::Color _color, sf::Vector2u _position);
+		private:
+			Diagnostics& m_diagnostics;
+			std::vector<Issue> m_issues;
+		};
+
+		Diagnostics() = default;
+		Diagnostics(const Diagnostics&) = delete;
+		Diagnostics& operator=(const Diagnostics&) = delete;
+
+		// Thread-safe, but locks for each call. Use a Local inside of loops.
+		void add(Kind _kind, Input _input, sf::Color _color, sf::Vector2u _position);
+
+		bool empty() const;
+		// All issues sorted by kind, input and color.
+		std::vector<Issue> issues() const;
+
+		// One warning for each issue. The positions are shifted by _offset.
+		void print(std::ostream& _out, sf::Vector2u _offset = {}) const;
+		// One line for each issue with the columns
+		// _prefix kind input color count x y
+		// where the color is given as hex rgba and x,y is the first position.
+		void writeReport(std::ostream& _out, const std::string& _prefix, sf::Vector2u _offset = {}) const;
+	private:
+		void merge(std::vector<Issue>& _issues);
+
+		mutable std::mutex m_mutex;
+		std::vector<Issue> m_issues;
+	};
+
+	const std::array<std::string, static_cast<size_t>(Diagnostics::Kind::COUNT)> DIAGNOSTIC_KIND_NAMES =
+	{ {
+		{"missing_zone"},
+		{"chain_timeout"},
+		{"multiple_chain_starts"},
+		{"misplaced_chain_start"},
+		{"unmatched_chain_start"},
+		{"chain_deadline"},
+	} };
+}
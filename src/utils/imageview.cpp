@@ -0,0 +1,28 @@
+#include "imageview.hpp"
+
+ImageBuffer::ImageBuffer(const sf::Vector2u& _size, const sf::Color& _fill)
+	: m_size(_size),
+	m_pixels(4 * static_cast<size_t>(_size.x) * _size.y)
+{
+	const MutableImageView pixels = view();
+	const PackedColor fill = packColor(_fill);
+	for (unsigned y = 0; y < m_size.y; ++y)
+		for (unsigned x = 0; x < m_size.x; ++x)
+			pixels.setPixel(x, y, fill);
+}
+
+ImageBuffer::ImageBuffer(const ImageView& _image)
+	: m_size(_image.getSize()),
+	m_pixels(4 * static_cast<size_t>(m_size.x) * m_size.y)
+{
+	for (unsigned y = 0; y < m_size.y; ++y)
+		std::memcpy(&m_pixels[4 * static_cast<size_t>(y) * m_size.x], _image.row(y), 4 * m_size.x);
+}
+
+sf::Image ImageBuffer::toImage() const
+{
+	sf::Image image;
+	if (m_size.x && m_size.y)
+		image.create(m_size.x, m_size.y, m_pixels.data());
+	return image;
+}
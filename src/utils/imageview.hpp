@@ -0,0 +1,120 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstring>
+#include <vector>
+#include <cassert>
+
+// A color packed into 32bit with the same byte order as the pixels of sf::Image.
+// Note that this is not the same value as sf::Color::toInteger().
+using PackedColor = sf::Uint32;
+
+inline PackedColor packColor(const sf::Color& _color)
+{
+	const sf::Uint8 bytes[4] = { _color.r, _color.g, _color.b, _color.a };
+	PackedColor packed;
+	std::memcpy(&packed, bytes, sizeof(PackedColor));
+	return packed;
+}
+
+inline sf::Color unpackColor(PackedColor _packed)
+{
+	sf::Uint8 bytes[4];
+	std::memcpy(bytes, &_packed, sizeof(PackedColor));
+	return sf::Color(bytes[0], bytes[1], bytes[2], bytes[3]);
+}
+
+// Non-owning view on rgba pixels with a row stride.
+// Access does no bounds checking and pixels are read as a single packed value.
+// @param Byte Either const sf::Uint8 for read-only or sf::Uint8 for mutable views.
+template<typename Byte>
+class BasicImageView
+{
+public:
+	BasicImageView() = default;
+	// @param _stride Distance between two rows in pixels.
+	BasicImageView(Byte* _pixels, const sf::Vector2u& _size, size_t _stride)
+		: m_pixels(_pixels), m_size(_size), m_stride(_stride)
+	{}
+	BasicImageView(Byte* _pixels, const sf::Vector2u& _size)
+		: BasicImageView(_pixels, _size, _size.x)
+	{}
+
+	// views of sf::Image are always read-only because sf::Image gives no direct write access
+	template<typename B = Byte, typename = std::enable_if_t<std::is_const_v<B>>>
+	BasicImageView(const sf::Image& _image)
+		: BasicImageView(_image.getPixelsPtr(), _image.getSize())
+	{}
+
+	// mutable views can be used where a read-only view is expected
+	template<typename B = Byte, typename = std::enable_if_t<std::is_const_v<B>>>
+	BasicImageView(const BasicImageView<sf::Uint8>& _view)
+		: BasicImageView(_view.data(), _view.getSize(), _view.stride())
+	{}
+
+	const sf::Vector2u& getSize() const { return m_size; }
+	size_t stride() const { return m_stride; }
+	Byte* data() const { return m_pixels; }
+	Byte* row(unsigned y) const { return m_pixels + 4 * y * m_stride; }
+
+	PackedColor operator()(unsigned x, unsigned y) const
+	{
+		assert(x < m_size.x && y < m_size.y);
+		PackedColor packed;
+		std::memcpy(&packed, row(y) + 4 * x, sizeof(PackedColor));
+		return packed;
+	}
+
+	sf::Color getPixel(unsigned x, unsigned y) const { return unpackColor((*this)(x, y)); }
+
+	template<typename B = Byte, typename = std::enable_if_t<!std::is_const_v<B>>>
+	void setPixel(unsigned x, unsigned y, PackedColor _color) const
+	{
+		assert(x < m_size.x && y < m_size.y);
+		std::memcpy(row(y) + 4 * x, &_color, sizeof(PackedColor));
+	}
+
+	template<typename B = Byte, typename = std::enable_if_t<!std::is_const_v<B>>>
+	void setPixel(unsigned x, unsigned y, const sf::Color& _color) const
+	{
+		setPixel(x, y, packColor(_color));
+	}
+
+	// View on a rectangle inside this view. No copy is made.
+	BasicImageView subView(const sf::IntRect& _rect) const
+	{
+		assert(_rect.left >= 0 && _rect.top >= 0
+			&& _rect.left + _rect.width <= static_cast<int>(m_size.x)
+			&& _rect.top + _rect.height <= static_cast<int>(m_size.y));
+		return BasicImageView(row(_rect.top) + 4 * _rect.left,
+			sf::Vector2u(_rect.width, _rect.height),
+			m_stride);
+	}
+private:
+	Byte* m_pixels = nullptr;
+	sf::Vector2u m_size;
+	size_t m_stride = 0;
+};
+
+using ImageView = BasicImageView<const sf::Uint8>;
+using MutableImageView = BasicImageView<sf::Uint8>;
+
+// Owning storage for images that are created by the core. It is only
+// converted to an sf::Image at the boundary, e.g. to write a file.
+class ImageBuffer
+{
+public:
+	ImageBuffer() = default;
+	explicit ImageBuffer(const sf::Vector2u& _size, const sf::Color& _fill = sf::Color::Black);
+	explicit ImageBuffer(const ImageView& _image);
+
+	const sf::Vector2u& getSize() const { return m_size; }
+
+	MutableImageView view() { return MutableImageView(m_pixels.data(), m_size); }
+	ImageView view() const { return ImageView(m_pixels.data(), m_size); }
+
+	sf::Image toImage() const;
+private:
+	sf::Vector2u m_size;
+	std::vector<sf::Uint8> m_pixels;
+};
@@ -1,5 +1,6 @@
 #include "spritesheet.hpp"
 #include "../math/matrix.hpp"
+#include "imageview.hpp"
 
 SpriteSheet::SpriteSheet(const std::string& _file, int _numFrames)
 {
@@ -16,9 +17,10 @@ SpriteSheet::SpriteSheet(const std::string& _file, int _numFrames)
 	}
 }
 
-std::pair<sf::Vector2u, sf::Vector2u> cropRect(const sf::Image& _image)
+std::pair<sf::Vector2u, sf::Vector2u> cropRect(const ImageView& _image)
 {
 	const sf::Vector2u size = _image.getSize();
+	const PackedColor transparent = packColor(sf::Color::Transparent);
 	sf::Vector2u min = size;
 	sf::Vector2u max{};
 
@@ -26,7 +28,7 @@ std::pair<sf::Vector2u, sf::Vector2u> cropRect(const sf::Image& _image)
 	{
 		for (unsigned x = 0; x < size.x; ++x)
 		{
-			if (_image.getPixel(x, y) != sf::Color::Transparent)
+			if (_image(x, y) != transparent)
 			{
 				if (min.x > x) min.x = x;
 				if (min.y > y) min.y = y;
@@ -152,14 +154,23 @@ sf::Image extendImage(const sf::Image& _img, const sf::Vector2u& _size, const sf
 
 // ************************************************************* //
 void setZeroAlpha(sf::Image& _img)
+{
+	ImageBuffer buffer(_img);
+	setZeroAlpha(buffer.view());
+	_img = buffer.toImage();
+}
+
+void setZeroAlpha(const MutableImageView& _img)
 {
 	const sf::Vector2u size = _img.getSize();
+	const PackedColor transparent = packColor(sf::Color::Transparent);
+	const PackedColor alphaMask = packColor(sf::Color(0, 0, 0, 255));
 	for (unsigned y = 0; y < size.y; ++y)
 	{
 		for (unsigned x = 0; x < size.x; ++x)
 		{
-			if (_img.getPixel(x, y).a == 0)
-				_img.setPixel(x, y, sf::Color::Transparent);
+			if ((_img(x, y) & alphaMask) == 0)
+				_img.setPixel(x, y, transparent);
 		}
 	}
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <SFML/Graphics.hpp>
+#include "imageview.hpp"
 
 struct SpriteSheet
 {
@@ -32,6 +33,7 @@ sf::Image extendImage(const sf::Image& _img, const sf::Vector2u& _size, const sf
 
 // set color of all pixels with alpha 0 to black
 void setZeroAlpha(sf::Image& _img);
+void setZeroAlpha(const MutableImageView& _img);
 
 sf::Color getPixelFlat(const sf::Image& _img, size_t _flat);
 sf::Vector2u getIndex(const sf::Image& _img, size_t _flat);
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+namespace utils {
+	unsigned ThreadPool::s_numThreads = std::max(1u, std::thread::hardware_concurrency());
+	thread_local int ThreadPool::s_nesting = 0;
+
+	ThreadPool& ThreadPool::get()
+	{
+		static ThreadPool pool(s_numThreads);
+		return pool;
+	}
+
+	void ThreadPool::setNumThreads(unsigned _numThreads)
+	{
+		s_numThreads = std::max(1u, _numThreads);
+	}
+
+	ThreadPool::ThreadPool(unsigned _numThreads)
+	{
+		// the thread that waits for the tasks is the last one
+		for (unsigned i = 1; i < _numThreads; ++i)
+			m_workers.emplace_back(&ThreadPool::workerMain, this);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::scoped_lock lock(m_mutex);
+			m_stop = true;
+		}
+		m_changed.notify_all();
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	void ThreadPool::submit(std::function<void()> _task, const TaskGroup* _group)
+	{
+		{
+			std::scoped_lock lock(m_mutex);
+			m_tasks.push_back(Task{ std::move(_task), _group });
+		}
+		// waiting threads may help as well, so all of them need to check
+		m_changed.notify_all();
+	}
+
+	void ThreadPool::notifyAll()
+	{
+		// the lock ensures that no thread is between checking its condition and waiting
+		{
+			std::scoped_lock lock(m_mutex);
+		}
+		m_changed.notify_all();
+	}
+
+	void ThreadPool::runTask(std::unique_lock<std::mutex>& _lock, std::deque<Task>::iterator _task)
+	{
+		std::function<void()> task = std::move(_task->run);
+		m_tasks.erase(_task);
+		_lock.unlock();
+		++s_nesting;
+		task();
+		--s_nesting;
+		_lock.lock();
+	}
+
+	void ThreadPool::workerMain()
+	{
+		helpUntil([this]() { return m_stop; });
+	}
+
+	// ************************************************************* //
+	void TaskGroup::run(std::function<void()> _task)
+	{
+		if (ThreadPool::isNestingLimitReached())
+		{
+			_task();
+			return;
+		}
+
+		++m_numPending;
+		// the group may be destroyed as soon as the counter reaches 0
+		m_pool.submit([pool = &m_pool, numPending = &m_numPending, task = std::move(_task)]()
+		{
+			task();
+			if (--*numPending == 0)
+				pool->notifyAll();
+		}, this);
+	}
+
+	void TaskGroup::wait()
+	{
+		m_pool.helpUntil([this]() { return m_numPending == 0; }, this);
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace utils {
+	class TaskGroup;
+
+	// Process-wide pool of worker threads that process tasks in submission order.
+	// Threads that wait for a TaskGroup run the pending tasks of that group in the 
+	// meantime, so nested parallel sections neither block the workers nor start 
+	// additional threads. Tasks of other groups, e.g. other frames, are left to the 
+	// workers so that they do not delay the wait.
+	// Helping puts the task on top of the stack of the waiting thread. To bound the stack,
+	// tasks that are started beyond MAX_NESTING levels run directly on the calling thread.
+	class ThreadPool
+	{
+	public:
+		static constexpr int MAX_NESTING = 4;
+
+		// The pool shared by the whole process. It is created on first use.
+		static ThreadPool& get();
+		// Set the number of threads that work on tasks, including the thread that waits
+		// for them. Has to be called before the first use of get(), e.g. with -j.
+		static void setNumThreads(unsigned _numThreads);
+
+		explicit ThreadPool(unsigned _numThreads);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		unsigned numThreads() const { return static_cast<unsigned>(m_workers.size()) + 1; }
+		// Number of pool tasks that run on the stack of the calling thread.
+		static int nesting() { return s_nesting; }
+		// New tasks of the calling thread should not be submitted to the pool.
+		static bool isNestingLimitReached() { return s_nesting >= MAX_NESTING; }
+
+		// @param _group The group that the task belongs to, if any.
+		void submit(std::function<void()> _task, const TaskGroup* _group = nullptr);
+
+		// Run tasks on the calling thread until _isDone returns true.
+		// _isDone is checked with the lock of the pool held.
+		// @param _group Only run tasks of this group. If not set, any task is run.
+		template<typename Pred>
+		void helpUntil(Pred _isDone, const TaskGroup* _group = nullptr)
+		{
+			std::unique_lock lock(m_mutex);
+			while (!_isDone())
+			{
+				const auto it = _group ? std::find_if(m_tasks.begin(), m_tasks.end(), 
+					[_group](const Task& _task) { return _task.group == _group; }) 
+					: m_tasks.begin();
+				if (it == m_tasks.end())
+					m_changed.wait(lock);
+				else
+					runTask(lock, it);
+			}
+		}
+
+		// Wake up threads that wait in helpUntil to check their condition again.
+		void notifyAll();
+	private:
+		struct Task
+		{
+			std::function<void()> run;
+			const TaskGroup* group;
+		};
+
+		void runTask(std::unique_lock<std::mutex>& _lock, std::deque<Task>::iterator _task);
+		void workerMain();
+
+		static unsigned s_numThreads;
+		static thread_local int s_nesting;
+
+		std::vector<std::thread> m_workers;
+		std::deque<Task> m_tasks;
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		bool m_stop = false;
+	};
+
+	// A set of tasks on the pool that can be waited for.
+	class TaskGroup
+	{
+	public:
+		explicit TaskGroup(ThreadPool& _pool = ThreadPool::get()) : m_pool(_pool) {}
+		~TaskGroup() { wait(); }
+
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+		void run(std::function<void()> _task);
+		// Blocks until all tasks of this group are finished.
+		void wait();
+	private:
+		ThreadPool& m_pool;
+		std::atomic<size_t> m_numPending = 0;
+	};
+}
@@ -1,33 +1,79 @@
 #pragma once
 
-#include <thread>
+#include "threadpool.hpp"
 #include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 
 namespace utils {
+	// Process [_begin, _end) in small chunks which are distributed dynamically over
+	// at most _numThreads threads of the global ThreadPool, including the calling thread.
 	// @param Fn function to be parallelized, should take a range (It,It)
 	// It must be random access for now
 	template<typename It, typename Fn>
 	void runMultiThreaded(It _begin, It _end, Fn _fn, size_t _numThreads = 1)
 	{
-		if (_numThreads == 1)
-			_fn(_begin, _end);
-		else
+		ThreadPool& pool = ThreadPool::get();
+		_numThreads = std::min(_numThreads, static_cast<size_t>(pool.numThreads()));
+		if (_numThreads <= 1 || _end - _begin <= 1 || ThreadPool::isNestingLimitReached())
 		{
-			std::vector<std::thread> threads;
-			threads.reserve(_numThreads - 1);
-
-			using DistanceType = decltype(_end - _begin);
-			const DistanceType n = static_cast<DistanceType>(_numThreads);
-			const DistanceType rows = (_end - _begin) / n;
-			for (DistanceType i = 0; i < n - 1; ++i)
-				threads.emplace_back(_fn, i * rows, (i + 1) * rows);
-			_fn((n - 1) * rows, _end);
-
-			for (auto& thread : threads)
-				thread.join();
+			_fn(_begin, _end);
+			return;
 		}
+
+		using DistanceType = decltype(_end - _begin);
+		const DistanceType size = _end - _begin;
+		// several chunks per thread so that uneven costs are balanced
+		constexpr DistanceType CHUNKS_PER_THREAD = 8;
+		const DistanceType chunkSize = std::max(DistanceType(1), 
+			size / (static_cast<DistanceType>(_numThreads) * CHUNKS_PER_THREAD));
+		std::atomic<DistanceType> next = 0;
+
+		auto processChunks = [&]()
+		{
+			for (DistanceType begin = next.fetch_add(chunkSize); begin < size; begin = next.fetch_add(chunkSize))
+				_fn(_begin + begin, _begin + std::min(begin + chunkSize, size));
+		};
+
+		TaskGroup tasks(pool);
+		for (size_t i = 1; i < _numThreads; ++i)
+			tasks.run(processChunks);
+		processChunks();
+		tasks.wait();
 	}
 
+	// Incremental 64 bit FNV-1a hash, e.g. to detect changed inputs.
+	// Values are added byte by byte, starting with the lowest.
+	class Hash
+	{
+	public:
+		void add(std::uint64_t _value)
+		{
+			for (int i = 0; i < 8; ++i, _value >>= 8)
+			{
+				m_value ^= _value & 0xff;
+				m_value *= 1099511628211ull;
+			}
+		}
+		void add(float _value)
+		{
+			std::uint32_t bits;
+			std::memcpy(&bits, &_value, sizeof(bits));
+			add(static_cast<std::uint64_t>(bits));
+		}
+		void add(std::string_view _str)
+		{
+			add(static_cast<std::uint64_t>(_str.size()));
+			for (char c : _str)
+				add(static_cast<std::uint64_t>(static_cast<unsigned char>(c)));
+		}
+
+		std::uint64_t value() const { return m_value; }
+	private:
+		std::uint64_t m_value = 14695981039346656037ull;
+	};
+
 	struct SplitNameResult
 	{
 		std::string_view name;
@@ -2,12 +2,16 @@
 #include <math/vectorext.hpp>
 #include <math/convolution.hpp>
 #include <core/pixelsimilarity.hpp>
+#include <core/pixelchains.hpp>
+#include <utils/imageview.hpp>
+#include <utils/spritesheet.hpp>
 
 #include <numeric>
 #include <iostream>
 #include <random>
 #include <fstream>
 #include <cstring>
+#include <sstream>
 //#include <numbers>
 
 # define EXPECT(cond,description)										\
@@ -85,6 +89,25 @@ int main()
 		EXPECT(epsEqual, "matrix is correctly loaded from text file");
 	}
 
+	// lazy matrix expressions
+	{
+		using namespace math;
+		const Matrix<float> a(sf::Vector2u(4, 3), 2.f);
+		Matrix<float> b(sf::Vector2u(4, 3), 1.f);
+		b(1, 2) = 5.f;
+		auto makeMatrix = [](float value) { return Matrix<float>(sf::Vector2u(4, 3), value); };
+
+		const Matrix<float> sum = a + b - makeMatrix(1.f) + 0.5f * makeMatrix(2.f);
+		EXPECT(sum(0, 0) == 3.f && sum(1, 2) == 7.f, "combined expression is evaluated element-wise");
+
+		Matrix<float> minimum = b;
+		minimum = min(minimum, a * 1.5f);
+		EXPECT(minimum(0, 0) == 1.f && minimum(1, 2) == 3.f, "expression can reference the destination");
+
+		b += a - makeMatrix(1.f);
+		EXPECT(b(0, 0) == 2.f && b(1, 2) == 6.f, "expressions can be accumulated");
+	}
+
 	// convolution
 	{
 		using namespace math;
@@ -143,6 +166,76 @@ int main()
 		EXPECT(wrongResults == 0, "padded convolution is applied correctly");
 	}
 
+	// tiled memory layout
+	{
+		using namespace math;
+		const sf::Vector2u size(13, 7);
+		Matrix<unsigned, TiledShape2D<2>> tiled(size);
+		Matrix<unsigned> rowMajor(size);
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+			{
+				tiled(x, y) = x + y * size.x;
+				rowMajor(x, y) = x + y * size.x;
+			}
+
+		int wrongResults = 0;
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+			{
+				if (tiled.index(tiled.flatIndex(x, y)) != sf::Vector2u(x, y))
+					++wrongResults;
+				if (tiled(x, y) != rowMajor(x, y))
+					++wrongResults;
+			}
+		EXPECT(wrongResults == 0, "tiled layout maps (x,y) to unique elements");
+		EXPECT(tiled.flatIndex(3, 3) == 15 && tiled.flatIndex(4, 0) == 16, "tiles are stored contiguously");
+
+		sf::Image image;
+		image.create(size.x, size.y, sf::Color(255, 0, 0));
+		for (unsigned x = 0; x < size.y; ++x)
+			image.setPixel(x, x, sf::Color(0, 4, 0));
+		Matrix<float> kernel(sf::Vector2u(3, 3), 1.f);
+		auto sample = [](float w, const sf::Color& color) { return w * color.g; };
+		auto sum = [](const Matrix<float>& result) { return std::accumulate(result.begin(), result.end(), 0.f); };
+		const auto tiledConv = applyConvolution(makePaddedImage<TiledShape2D<2>>(image, sf::Vector2u(1, 1)),
+			size, kernel, sample, sum);
+		const auto rowMajorConv = applyConvolution(makePaddedImage<ArrayShape2D>(image, sf::Vector2u(1, 1)),
+			size, kernel, sample, sum);
+		EXPECT(tiledConv == rowMajorConv, "convolution is independent of the layout");
+	}
+
+	// image view
+	{
+		const sf::Vector2u size(5, 4);
+		sf::Image image;
+		image.create(size.x, size.y, sf::Color(1, 2, 3, 0));
+		image.setPixel(2, 1, sf::Color(10, 20, 30, 40));
+		const ImageView view(image);
+		EXPECT(view.getPixel(2, 1) == image.getPixel(2, 1)
+			&& unpackColor(view(2, 1)) == sf::Color(10, 20, 30, 40), "image view reads packed pixels");
+
+		const ImageView sub = view.subView(sf::IntRect(1, 1, 3, 2));
+		EXPECT(sub.getSize() == sf::Vector2u(3, 2) && sub.getPixel(1, 0) == sf::Color(10, 20, 30, 40),
+			"sub view shares the pixels with a stride");
+
+		TransferMap identity(size);
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+				identity(x, y) = sf::Vector2u(x, y);
+		const sf::Image applied = applyMap(identity, view);
+		int wrongResults = 0;
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+				if (applied.getPixel(x, y) != image.getPixel(x, y))
+					++wrongResults;
+		EXPECT(wrongResults == 0, "identity map reproduces the image");
+
+		setZeroAlpha(image);
+		EXPECT(image.getPixel(0, 0) == sf::Color::Transparent && image.getPixel(2, 1) == sf::Color(10, 20, 30, 40),
+			"only pixels with alpha 0 are set to transparent");
+	}
+
 	// rotation of kernel distance
 	{
 	//	using std::numbers::pi;
@@ -207,6 +300,535 @@ int main()
 			"7/4 pi rotation");
 	}
 
+	// border of kernel distance
+	{
+		// transparent and black pixels next to the border, where they can match the padding
+		const sf::Vector2u size(4, 3);
+		sf::Image src;
+		src.create(size.x, size.y, sf::Color(255, 0, 0));
+		src.setPixel(0, 0, sf::Color::Transparent);
+		src.setPixel(3, 2, sf::Color::Black);
+		sf::Image dst;
+		dst.create(size.x, size.y, sf::Color(255, 0, 0));
+		dst.setPixel(3, 0, sf::Color::Transparent);
+		dst.setPixel(0, 2, sf::Color::Black);
+
+		// the source is padded as by sf::Image::create and the target is transparent outside
+		auto srcPadded = [&](int x, int y)
+		{
+			return x < 0 || y < 0 || x >= static_cast<int>(size.x) || y >= static_cast<int>(size.y)
+				? sf::Color(0, 0, 0, 255) : src.getPixel(x, y);
+		};
+		const KernelDistance distance(src, dst, sf::Vector2u(3, 3), 0.f);
+		bool isEqual = true;
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+			{
+				const math::Matrix<float> dense = distance(x, y);
+				const auto forTarget = distance.forTarget(x, y);
+				for (unsigned sy = 0; sy < size.y; ++sy)
+					for (unsigned sx = 0; sx < size.x; ++sx)
+					{
+						float expected = 0.f;
+						for (int j = -1; j <= 1; ++j)
+							for (int i = -1; i <= 1; ++i)
+								expected += getPixelPadded(dst, x + i, y + j) == srcPadded(sx + i, sy + j) ? 0.f : 1.f;
+						expected /= 9.f;
+						isEqual &= dense(sx, sy) == expected && forTarget(sf::Vector2u(sx, sy)) == expected;
+					}
+			}
+		EXPECT(isEqual, "the border of the source differs from the transparent target border");
+	}
+
+	// map construction with single candidate evaluation
+	{
+		const sf::Vector2u size(12, 10);
+		std::uniform_int_distribution<int> colorDist(0, 3);
+		auto makeImage = [&]()
+		{
+			sf::Image img;
+			img.create(size.x, size.y);
+			for (unsigned y = 0; y < size.y; ++y)
+				for (unsigned x = 0; x < size.x; ++x)
+					img.setPixel(x, y, sf::Color(colorDist(rng) * 60, 0, 0));
+			return img;
+		};
+		const sf::Image src = makeImage();
+		const sf::Image dst = makeImage();
+		TransferMap prior(size);
+		for (auto& el : prior.elements)
+			el = sf::Vector2u(dist(rng) % size.x, dist(rng) % size.y);
+
+		// reference search on the dense distances
+		auto denseMap = [&](const auto& _distance)
+		{
+			TransferMap map(size);
+			for (unsigned y = 0; y < size.y; ++y)
+				for (unsigned x = 0; x < size.x; ++x)
+				{
+					const math::Matrix<float> distance = _distance(x, y);
+					size_t minInd = distance.flatIndex(x, y);
+					auto minEl = std::min_element(distance.begin(), distance.end());
+					if (*minEl < distance(x, y))
+						minInd = std::distance(distance.begin(), minEl);
+					map(x, y) = distance.index(minInd);
+				}
+			return map;
+		};
+
+		const math::Matrix<float> kernel(sf::Vector2u(3, 3), 1.f);
+		std::vector<KernelDistance> kernelDistances;
+		kernelDistances.emplace_back(src, dst, kernel);
+		kernelDistances.emplace_back(dst, src, kernel);
+		const GroupDistanceThreshold<KernelDistance> groupDistance(std::move(kernelDistances));
+		EXPECT(constructMap(groupDistance).first == denseMap(groupDistance),
+			"search of single candidates is equal to the dense search");
+
+		const SourcePlanes srcPlanes{ ImageView(src) };
+		EXPECT(srcPlanes.padded({ 1, 1 }) == srcPlanes.padded({ 1, 1 }) 
+			&& srcPlanes.blurred(kernel) == srcPlanes.blurred(kernel), "source planes are computed once");
+		const RotInvariantKernelDistance sharedDistance(srcPlanes, dst, kernel);
+		const BlurDistance sharedBlur(srcPlanes, dst, kernel);
+		EXPECT(sharedDistance(3, 4) == RotInvariantKernelDistance(src, dst, kernel)(3, 4)
+			&& sharedBlur(5, 2) == BlurDistance(src, dst, kernel)(5, 2),
+			"distances with shared source planes are equal");
+
+		const SumDistance priorDistance(IdentityDistance(src, dst), ScaleDistance(MapDistance(prior), 0.5f));
+		EXPECT(constructMap(priorDistance, nullptr, 2).first == denseMap(priorDistance),
+			"search around an analytic prior is equal to the dense search");
+
+		// margin to the second best candidate
+		auto denseMargin = [&](const auto& _distance)
+		{
+			math::Matrix<float> margin(size);
+			for (unsigned y = 0; y < size.y; ++y)
+				for (unsigned x = 0; x < size.x; ++x)
+				{
+					math::Matrix<float> distance = _distance(x, y);
+					std::partial_sort(distance.begin(), distance.begin() + 2, distance.end());
+					margin(x, y) = distance[1] - distance[0];
+				}
+			return margin;
+		};
+		math::Matrix<float> margin;
+		MapSearchOptions options;
+		options.margin = &margin;
+		EXPECT(constructMap(groupDistance, nullptr, 1, {}, options).first == denseMap(groupDistance)
+			&& margin == denseMargin(groupDistance),
+			"margin of the search is the difference of the two smallest distances");
+		EXPECT(constructMap(priorDistance, nullptr, 2, {}, options).first == denseMap(priorDistance)
+			&& margin == denseMargin(priorDistance),
+			"margin of the search around a prior");
+
+		// cascade: only masked targets are searched again
+		PixelMask targetMask(size);
+		for (auto& el : targetMask.elements)
+			el = dist(rng) % 2;
+		options = MapSearchOptions{};
+		options.targetMask = &targetMask;
+		options.initialMap = &prior;
+		const TransferMap fullMap = constructMap(groupDistance).first;
+		const TransferMap refinedMap = constructMap(groupDistance, nullptr, 1, {}, options).first;
+		bool isMasked = true;
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+				isMasked &= refinedMap(x, y) == (targetMask(x, y) ? fullMap(x, y) : prior(x, y));
+		EXPECT(isMasked, "targets outside the mask keep the initial map");
+
+		// temporal seeding
+		options = MapSearchOptions{};
+		options.seedMap = &prior;
+		options.seedThreshold = -1.f;
+		EXPECT(constructMap(groupDistance, nullptr, 1, {}, options).first == fullMap,
+			"search with seeds that are never accepted is equal to the full search");
+		options.seedMap = &fullMap;
+		options.seedThreshold = std::numeric_limits<float>::infinity();
+		EXPECT(constructMap(groupDistance, nullptr, 1, {}, options).first == fullMap,
+			"seeding with the optimal map finds the optimal map");
+
+		// several measures in one traversal
+		std::vector<AnyDistance> measures;
+		measures.emplace_back(groupDistance);
+		measures.emplace_back(priorDistance);
+		measures.emplace_back(IdentityDistance(src, dst));
+		const auto maps = constructMaps(measures, nullptr, 2);
+		EXPECT(maps.size() == 3
+			&& maps[0] == constructMap(groupDistance)
+			&& maps[1] == constructMap(priorDistance)
+			&& maps[2] == constructMap(IdentityDistance(src, dst)),
+			"combined search is equal to separate searches");
+
+		// zone-major search with src and dst as their own zone maps
+		const ZoneMap zoneMap(src, dst);
+		auto zoneDistance = [&](unsigned x, unsigned y)
+		{
+			math::Matrix<float> distance = groupDistance(x, y);
+			const PixelList& zone = zoneMap(x, y);
+			for (size_t i = 0; i < distance.elements.size(); ++i)
+				if (std::find(zone.begin(), zone.end(), i) == zone.end())
+					distance[i] = std::numeric_limits<float>::infinity();
+			return distance;
+		};
+		bool isZoneIndexConsistent = true;
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+			{
+				const PixelList& zone = zoneMap(x, y);
+				isZoneIndexConsistent &= &zone == &zoneMap(dst.getPixel(x, y))
+					&& std::is_sorted(zone.begin(), zone.end());
+				for (size_t i = 0; i < math::ArrayShape2D::numElements(size); ++i)
+					isZoneIndexConsistent &= zoneMap.sharesZone(i, x, y) == std::binary_search(zone.begin(), zone.end(), i);
+			}
+		EXPECT(isZoneIndexConsistent, "zone ids agree with the zone colors");
+		const auto srcZones = std::make_shared<const ZoneIndex>(src);
+		const ZoneMap sharedZoneMap(srcZones, dst);
+		const ZoneMap otherZoneMap(srcZones, src);
+		bool isSharedConsistent = true;
+		for (unsigned y = 0; y < size.y; ++y)
+			for (unsigned x = 0; x < size.x; ++x)
+				isSharedConsistent &= sharedZoneMap.zoneId(x, y) == zoneMap.zoneId(x, y)
+					&& &sharedZoneMap(x, y) == &otherZoneMap.zone(sharedZoneMap.zoneId(x, y))
+					&& otherZoneMap.zoneId(x, y) == srcZones->zoneId(x + y * size.x);
+		EXPECT(isSharedConsistent, "zone maps can share the source index");
+		const TransferMap zoneMajorMap = constructMap(groupDistance, &zoneMap, 2).first;
+		EXPECT(zoneMajorMap == denseMap(zoneDistance), "zone-major search is equal to the dense search");
+		std::vector<AnyDistance> zoneMeasures;
+		zoneMeasures.emplace_back(groupDistance);
+		EXPECT(constructMaps(zoneMeasures, &zoneMap, 2).front().first == zoneMajorMap,
+			"combined zone-major search is equal to the single search");
+
+		// shards
+		const unsigned numShards = 3;
+		std::vector<ShardHeader> headers;
+		std::vector<std::vector<TransferMap>> shardMaps;
+		for (unsigned i = 0; i < numShards; ++i)
+		{
+			const Shard shard{ i, numShards };
+			PixelMask shardMask(size);
+			for (unsigned y = 0; y < size.y; ++y)
+				for (unsigned x = 0; x < size.x; ++x)
+					shardMask(x, y) = shard.ownsRow(1, y, size.y);
+			MapSearchOptions shardOptions;
+			shardOptions.targetMask = &shardMask;
+			headers.push_back(ShardHeader{ shard, sf::IntRect(0, 0, size.x, size.y), { { 0, 1 } } });
+			const TransferMap shardMap = constructMap(groupDistance, nullptr, 1, {}, shardOptions).first;
+			shardMaps.push_back({ TransferMap(size), shardMap });
+		}
+		const TransferMap singleMap = constructMap(groupDistance).first;
+		const std::vector<TransferMap> merged = mergeShards(headers, shardMaps);
+		EXPECT(merged.size() == 2 && merged[1] == singleMap && merged[0] == singleMap,
+			"merged shards are equal to a single search");
+		std::stringstream headerStream;
+		headerStream << headers[2];
+		ShardHeader readHeader;
+		headerStream >> readHeader;
+		EXPECT(readHeader.shard.index == 2 && readHeader.reusedFrames.size() == 1 && readHeader.reusedFrames[0].source == 1,
+			"shard header serialization");
+		std::swap(headers[1], headers[2]);
+		headers[2].shard.index = 0;
+		EXPECT(mergeShards(headers, shardMaps).empty(), "shards have to be complete");
+	}
+
+	// checkpoints
+	{
+		const sf::Vector2u size(5, 3);
+		std::vector<TransferMap> maps(2, TransferMap(size));
+		for (TransferMap& map : maps)
+			for (auto& el : map.elements)
+				el = sf::Vector2u(dist(rng) % size.x, dist(rng) % size.y);
+		std::stringstream checkpoint;
+		writeCheckpoint(checkpoint, 0xabcdef0123456789ull, maps);
+		const std::string data = checkpoint.str();
+
+		std::vector<TransferMap> loaded;
+		std::stringstream in(data);
+		EXPECT(readCheckpoint(in, 0xabcdef0123456789ull, size, loaded) && loaded == maps,
+			"checkpoint round trip");
+		std::stringstream otherHash(data);
+		EXPECT(!readCheckpoint(otherHash, 0xabcdef0123456788ull, size, loaded),
+			"checkpoints of other inputs are rejected");
+		std::stringstream otherSize(data);
+		EXPECT(!readCheckpoint(otherSize, 0xabcdef0123456789ull, sf::Vector2u(3, 5), loaded),
+			"checkpoints of other references are rejected");
+		std::stringstream truncated(data.substr(0, data.size() / 2));
+		EXPECT(!readCheckpoint(truncated, 0xabcdef0123456789ull, size, loaded),
+			"incomplete checkpoints are rejected");
+	}
+
+	// active region
+	{
+		const sf::Vector2u size(16, 14);
+		std::uniform_int_distribution<int> colorDist(0, 2);
+		auto makeImage = [&]()
+		{
+			sf::Image img;
+			img.create(size.x, size.y, sf::Color(0, 0, 0, 0));
+			for (unsigned y = 5; y < 9; ++y)
+				for (unsigned x = 5; x < 11; ++x)
+					img.setPixel(x, y, sf::Color(colorDist(rng) * 100, 0, 0));
+			return img;
+		};
+		const sf::Image src = makeImage();
+		const sf::Image dst = makeImage();
+
+		const math::Matrix<float> kernel(sf::Vector2u(3, 3), 1.f);
+		std::vector<KernelDistance> distances;
+		distances.emplace_back(src, dst, kernel);
+		const GroupDistanceThreshold<KernelDistance> distance(std::move(distances));
+
+		const PixelMask active = makeActiveMask({ src, dst }, 2);
+		EXPECT(active(3, 3) && !active(2, 3) && active(12, 10) && !active(13, 10), "active mask is dilated");
+
+		PixelList candidates = maskToPixelList(active);
+		candidates.insert(candidates.begin(), 0);
+		MapSearchOptions options;
+		options.targetMask = &active;
+		options.candidates = &candidates;
+		EXPECT(constructMap(distance, nullptr, 1, {}, options).first == constructMap(distance).first,
+			"restricting the search to the active region does not change the map");
+	}
+
+	// mirrored map
+	{
+		TransferMap srcMap(sf::Vector2u(8, 6));
+		for (auto& el : srcMap.elements)
+			el = sf::Vector2u(dist(rng) % 8, dist(rng) % 6);
+		const TransferMap mirrored = mirrorMap(srcMap, false);
+		EXPECT(mirrored(0, 2) == srcMap(7, 2) && mirrored(5, 4) == srcMap(2, 4), "targets are mirrored");
+		EXPECT(mirrorMap(mirrored, false) == srcMap && mirrorMap(mirrorMap(srcMap, true), true) == srcMap,
+			"mirroring twice is the identity");
+		EXPECT(mirrorMap(srcMap, true)(1, 0).x == 7 - srcMap(6, 0).x, "sources are mirrored");
+	}
+
+	// thread pool
+	{
+		std::vector<std::atomic<int>> visits(97 * 13);
+		utils::runMultiThreaded(0u, 97u, [&](unsigned begin, unsigned end)
+			{
+				for (unsigned i = begin; i < end; ++i)
+					utils::runMultiThreaded(0u, 13u, [&](unsigned innerBegin, unsigned innerEnd)
+						{
+							for (unsigned j = innerBegin; j < innerEnd; ++j)
+								++visits[i * 13 + j];
+						}, 4);
+			}, 4);
+		EXPECT(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& v) { return v == 1; }),
+			"nested parallel loops visit every element once");
+
+		// recursive parallel sections as in a tree search
+		std::atomic<int> numLeaves = 0;
+		std::atomic<int> maxNesting = 0;
+		std::function<void(int)> recurse = [&](int depth)
+		{
+			int nesting = maxNesting;
+			while (nesting < utils::ThreadPool::nesting()
+				&& !maxNesting.compare_exchange_weak(nesting, utils::ThreadPool::nesting()))
+			{}
+			if (depth == 0)
+			{
+				++numLeaves;
+				return;
+			}
+			utils::runMultiThreaded(0, 3, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i)
+						recurse(depth - 1);
+				}, 4);
+		};
+		recurse(8);
+		EXPECT(numLeaves == 6561 && maxNesting <= utils::ThreadPool::MAX_NESTING,
+			"helping threads nest tasks only up to the limit");
+
+		// a pool without workers, so that all tasks run on the waiting thread
+		utils::ThreadPool pool(1);
+		std::vector<int> order;
+		{
+			utils::TaskGroup outer(pool);
+			outer.run([&]()
+				{
+					utils::TaskGroup inner(pool);
+					inner.run([&]() { order.push_back(1); });
+					inner.wait();
+					order.push_back(2);
+				});
+			outer.run([&]() { order.push_back(3); });
+		}
+		EXPECT(order == std::vector<int>({ 1, 2, 3 }),
+			"a nested wait does not run the tasks that were submitted before it");
+	}
+
+	// pixel chains
+	{
+		sf::Image image;
+		image.create(5, 3, sf::Color::Transparent);
+		const std::vector<sf::Vector2u> line = { {2, 2}, {2, 1}, {2, 0}, {1, 0}, {0, 0} };
+		for (const sf::Vector2u& p : line)
+			image.setPixel(p.x, p.y, sf::Color::Red);
+		image.setPixel(2, 2, sf::Color(255, 0, 0, 155));
+		utils::Diagnostics diagnostics;
+		const auto zones = std::make_shared<const ZoneIndex>(image, true);
+		const ReferenceChains chains(image, zones, 1.f, -1.f, 1, diagnostics);
+		const ReferenceChains::Chain& chain = chains.chain(zones->findZone(sf::Color::Red.toInteger()));
+		EXPECT(chain.pixels == line && chain.isMarked && !chain.hadTimeout && diagnostics.empty(),
+			"chain search starts at the marker and visits the line in order");
+
+		// without a marker, the chain grows greedily from the last pixel
+		image.setPixel(2, 2, sf::Color::Red);
+		const auto unmarkedZones = std::make_shared<const ZoneIndex>(image, true);
+		const ReferenceChains unmarkedChains(image, unmarkedZones, 1.f, -1.f, 1, diagnostics);
+		EXPECT(unmarkedChains.chain(unmarkedZones->findZone(sf::Color::Red.toInteger())).pixels 
+			== std::vector<sf::Vector2u>(line.rbegin(), line.rend()),
+			"greedy chain follows the line");
+
+		// a staircase has corners that are connected diagonally as well
+		sf::Image stairs;
+		stairs.create(64, 64, sf::Color::Transparent);
+		std::vector<sf::Vector2u> stairLine;
+		for (unsigned i = 0; i < 63; ++i)
+		{
+			stairLine.emplace_back(i, i);
+			stairLine.emplace_back(i + 1, i);
+		}
+		for (const sf::Vector2u& p : stairLine)
+			stairs.setPixel(p.x, p.y, sf::Color::Red);
+		stairs.setPixel(0, 0, sf::Color(255, 0, 0, 155));
+		const auto stairZones = std::make_shared<const ZoneIndex>(stairs, true);
+		const ReferenceChains stairChains(stairs, stairZones, 1.f, -1.f, 1, diagnostics);
+		const ReferenceChains::Chain& stairChain = stairChains.chain(stairZones->findZone(sf::Color::Red.toInteger()));
+		EXPECT(stairChain.pixels == stairLine && !stairChain.hadTimeout, "long lines are ordered without a search");
+
+		// without time left for a search, the walk from the marker is kept
+		sf::Image square;
+		square.create(6, 6, sf::Color::Red);
+		square.setPixel(0, 0, sf::Color(255, 0, 0, 155));
+		const auto squareZones = std::make_shared<const ZoneIndex>(square, true);
+		utils::Diagnostics squareDiagnostics;
+		const ReferenceChains squareChains(square, squareZones, 1.f, 0.f, 1, squareDiagnostics);
+		const ReferenceChains::Chain& squareChain = squareChains.chain(squareZones->findZone(sf::Color::Red.toInteger()));
+		const std::vector<utils::Diagnostics::Issue> squareIssues = squareDiagnostics.issues();
+		EXPECT(squareChain.pixels.size() == 36 && squareChain.isMarked && squareChain.hitDeadline && !squareChain.hadTimeout
+			&& squareIssues.size() == 1 && squareIssues[0].kind == utils::Diagnostics::Kind::ChainDeadline,
+			"chains that are not searched within the time budget are reported");
+
+		// a zone with junctions needs the search, which gives the same chain on any number of threads
+		sf::Image junctions;
+		junctions.create(4, 4, sf::Color::Red);
+		junctions.setPixel(0, 0, sf::Color(255, 0, 0, 155));
+		const auto junctionZones = std::make_shared<const ZoneIndex>(junctions, true);
+		const ZoneIndex::ZoneId junctionId = junctionZones->findZone(sf::Color::Red.toInteger());
+		auto searchJunctions = [&](unsigned _numThreads, float _budget)
+		{
+			utils::Diagnostics junctionDiagnostics;
+			const ReferenceChains junctionChains(junctions, junctionZones, 10.f, _budget, _numThreads, junctionDiagnostics);
+			const ReferenceChains::Chain& chain = junctionChains.chain(junctionId);
+			return junctionDiagnostics.empty() && !chain.hadTimeout && !chain.hitDeadline 
+				? chain.pixels : PixelChain();
+		};
+		const PixelChain junctionChain = searchJunctions(1, -1.f);
+		float junctionLength = 0.f;
+		for (size_t i = 1; i < junctionChain.size(); ++i)
+		{
+			const sf::Vector2f step(sf::Vector2i(junctionChain[i]) - sf::Vector2i(junctionChain[i - 1]));
+			junctionLength += std::sqrt(step.x * step.x + step.y * step.y);
+		}
+		EXPECT(junctionChain.size() == 16 && junctionChain.front() == sf::Vector2u(0, 0) && junctionLength == 15.f,
+			"the search finds a shortest chain from the marker");
+		EXPECT(searchJunctions(4, -1.f) == junctionChain && searchJunctions(1, 10.f) == junctionChain
+			&& searchJunctions(4, 10.f) == junctionChain,
+			"the chain does not depend on the number of threads and the time budget");
+
+		// frames in parallel, a thread that waits for its search does not run other frames
+		auto makeBlock = [](unsigned _size)
+		{
+			sf::Image block;
+			block.create(_size, _size, sf::Color::Red);
+			block.setPixel(0, 0, sf::Color(255, 0, 0, 155));
+			return block;
+		};
+		const sf::Image largeBlock = makeBlock(8);
+		const sf::Image smallBlock = makeBlock(3);
+		const auto largeZones = std::make_shared<const ZoneIndex>(largeBlock, true);
+		const auto smallZones = std::make_shared<const ZoneIndex>(smallBlock, true);
+		const ZoneIndex::ZoneId smallId = smallZones->findZone(sf::Color::Red.toInteger());
+		utils::Diagnostics sequentialDiagnostics;
+		const PixelChain smallChain = ReferenceChains(smallBlock, smallZones, 0.2f, -1.f, 1, sequentialDiagnostics)
+			.chain(smallId).pixels;
+		std::vector<std::unique_ptr<utils::Diagnostics>> frameDiagnostics;
+		std::vector<std::unique_ptr<ReferenceChains>> frameChains(5);
+		for (size_t i = 0; i < frameChains.size(); ++i)
+			frameDiagnostics.push_back(std::make_unique<utils::Diagnostics>());
+		{
+			utils::TaskGroup frames;
+			for (size_t i = 0; i < frameChains.size(); ++i)
+				frames.run([&, i]()
+					{
+						frameChains[i] = i == 0
+							? std::make_unique<ReferenceChains>(largeBlock, largeZones, 0.2f, -1.f, 4, *frameDiagnostics[i])
+							: std::make_unique<ReferenceChains>(smallBlock, smallZones, 0.2f, -1.f, 4, *frameDiagnostics[i]);
+					});
+		}
+		bool isSmallValid = sequentialDiagnostics.empty();
+		for (size_t i = 1; i < frameChains.size(); ++i)
+			isSmallValid &= frameDiagnostics[i]->empty() && frameChains[i]->chain(smallId).pixels == smallChain;
+		EXPECT(frameChains[0]->chain(largeZones->findZone(sf::Color::Red.toInteger())).hadTimeout && isSmallValid,
+			"searches of parallel frames are only charged for their own time");
+
+		// columns of different lengths and colors, the last one only exists in the target
+		sf::Image columns;
+		columns.create(16, 12, sf::Color::Transparent);
+		for (unsigned x = 0; x < 15; ++x)
+			for (unsigned y = 0; y < 4 + x % 8; ++y)
+				columns.setPixel(x, y, sf::Color(20 + x * 10, 255 - x * 10, 0, y ? 255 : 155));
+		sf::Image targetColumns = columns;
+		for (unsigned y = 0; y < 6; ++y)
+			targetColumns.setPixel(15, y, sf::Color::Red);
+		const auto columnZones = std::make_shared<const ZoneIndex>(columns, true);
+		const ZoneIndex targetZones(targetColumns, true);
+		auto mapColumns = [&](unsigned _numThreads, sf::Image& _errorImage)
+		{
+			_errorImage.create(16, 12, sf::Color::Transparent);
+			ErrorImageWrapper errorRef(_errorImage);
+			ErrorImageWrapper errorTarget(_errorImage);
+			utils::Diagnostics columnDiagnostics;
+			const ReferenceChains columnChains(columns, columnZones, 1.f, -1.f, _numThreads, columnDiagnostics);
+			return constructMap(columns, targetColumns, columnChains, targetZones, OrientationHeuristic::MinDistance,
+				errorRef, errorTarget, 1.f, -1.f, _numThreads, columnDiagnostics);
+		};
+		sf::Image errorSingle, errorMulti;
+		const TransferMap singleColumns = mapColumns(1, errorSingle);
+		const TransferMap multiColumns = mapColumns(4, errorMulti);
+		bool sameErrors = true;
+		for (unsigned y = 0; y < 12; ++y)
+			for (unsigned x = 0; x < 16; ++x)
+				sameErrors &= errorSingle.getPixel(x, y) == errorMulti.getPixel(x, y);
+		EXPECT(singleColumns == multiColumns && sameErrors && singleColumns(sf::Vector2u(3, 6)) == sf::Vector2u(3, 6)
+			&& errorMulti.getPixel(15, 0).r == 255,
+			"zones are mapped in parallel");
+	}
+
+	// diagnostics
+	{
+		using utils::Diagnostics;
+		Diagnostics diagnostics;
+		utils::runMultiThreaded(0u, 16u, [&](unsigned begin, unsigned end)
+			{
+				Diagnostics::Local issues(diagnostics);
+				for (unsigned y = begin; y < end; ++y)
+					for (unsigned x = 0; x < 4; ++x)
+						issues.add(Diagnostics::Kind::MissingZone, Diagnostics::Input::Target, 
+							x % 2 ? sf::Color::Red : sf::Color::Green, sf::Vector2u(x, 15 - y));
+			}, 4);
+		diagnostics.add(Diagnostics::Kind::MissingZone, Diagnostics::Input::Target, sf::Color::Red, sf::Vector2u(1, 0));
+		const std::vector<Diagnostics::Issue> issues = diagnostics.issues();
+		EXPECT(issues.size() == 2 && issues[0].color == sf::Color::Green && issues[1].positions.size() == 32
+			&& issues[1].positions.front() == sf::Vector2u(1, 0) && issues[1].positions.back() == sf::Vector2u(3, 15),
+			"issues are aggregated by color and their positions are unique");
+		std::stringstream report;
+		diagnostics.writeReport(report, "7", sf::Vector2u(2, 1));
+		EXPECT(report.str() == "7 missing_zone target 00ff00ff 32 2 1\n7 missing_zone target ff0000ff 32 3 1\n",
+			"report has one line per issue");
+	}
+
 	std::cout << "\nSuccessfully finished tests " << testsRun - testsFailed << "/" << testsRun << "\n";
 
 	return testsFailed;